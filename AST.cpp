@@ -3,14 +3,70 @@
 //
 
 #include "AST.hpp"
+#include "DebugInfo.hpp"
+#include "Profile.hpp"
+#include "Report.hpp"
 
 #include "magic_enum/magic_enum.hpp"
 #include <format>
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Verifier.h>
+#include <unordered_set>
+
+thread_local std::unique_ptr<llvm::LLVMContext> TheContext;
+thread_local std::unique_ptr<llvm::IRBuilder<>> Builder;
+thread_local std::unique_ptr<llvm::Module> TheModule;
+thread_local std::unordered_map<std::string, llvm::AllocaInst *> NamedValues;
+
+void LLVMInit(const std::string &module_name) {
+  // the previous module goes before its context
+  Toy::resetDebugInfo();
+  Builder.reset();
+  TheModule.reset();
+  NamedValues.clear();
+  TheContext = std::make_unique<llvm::LLVMContext>();
+  TheModule = std::make_unique<llvm::Module>(module_name, *TheContext);
+  Builder = std::make_unique<llvm::IRBuilder<>>(*TheContext);
+  Toy::resetProfile();
+  Toy::resetReport();
+}
 
 namespace Toy {
+namespace {
+struct MathBuiltin {
+  llvm::Intrinsic::ID id;
+  unsigned arity;
+};
+const std::unordered_map<std::string, MathBuiltin> mathBuiltins{
+    {"sqrt", {llvm::Intrinsic::sqrt, 1}},
+    {"sin", {llvm::Intrinsic::sin, 1}},
+    {"cos", {llvm::Intrinsic::cos, 1}},
+    {"exp", {llvm::Intrinsic::exp, 1}},
+    {"exp2", {llvm::Intrinsic::exp2, 1}},
+    {"log", {llvm::Intrinsic::log, 1}},
+    {"log2", {llvm::Intrinsic::log2, 1}},
+    {"log10", {llvm::Intrinsic::log10, 1}},
+    {"fabs", {llvm::Intrinsic::fabs, 1}},
+    {"floor", {llvm::Intrinsic::floor, 1}},
+    {"ceil", {llvm::Intrinsic::ceil, 1}},
+    {"trunc", {llvm::Intrinsic::trunc, 1}},
+    {"round", {llvm::Intrinsic::round, 1}},
+    {"pow", {llvm::Intrinsic::pow, 2}},
+    {"fmin", {llvm::Intrinsic::minnum, 2}},
+    {"fmax", {llvm::Intrinsic::maxnum, 2}},
+    {"copysign", {llvm::Intrinsic::copysign, 2}},
+    {"fma", {llvm::Intrinsic::fma, 3}},
+};
+} // namespace
+
+unsigned mathArity(const std::string &name) {
+  auto it = mathBuiltins.find(name);
+  return it == mathBuiltins.end() ? 0 : it->second.arity;
+}
+
 std::string NumberExprAST::to_string() const { return std::to_string(value); }
+std::string IntegerExprAST::to_string() const { return std::to_string(value); }
 std::string VariableExprAST::to_string() const { return this->name; }
 std::string BinaryExprAST::to_string() const {
   return std::format("{} {} {}", this->lhs->to_string(),
@@ -28,14 +84,26 @@ std::string CallExprAST::to_string() const {
   return std::format("{}({})", this->callee, args);
 }
 std::string PrototypeAST::to_string() const {
+  std::string attrs;
+  for (auto &i : attributes) {
+    attrs += std::format("@{} ", i);
+  }
   std::string args;
   for (auto &i : arguments) {
-    args += i + ",";
+    args += i.name;
+    if (i.type != Type::Unknown) {
+      args += std::format(": {}", magic_enum::enum_name(i.type));
+    }
+    args += ",";
   }
   if (!args.empty()) {
     args.pop_back();
   }
-  return std::format("PrototypeAST({}({}))", this->name, args);
+  if (ret.type != Type::Unknown) {
+    return std::format("PrototypeAST({}{}({}): {})", attrs, this->name, args,
+                       magic_enum::enum_name(ret.type));
+  }
+  return std::format("PrototypeAST({}{}({}))", attrs, this->name, args);
 }
 std::string FunctionAST::to_string() const {
   return std::format("FunctionAST({})\n\t{}", this->proto->to_string(),
@@ -46,15 +114,253 @@ std::string IfElseExprAST::to_string() const {
                      this->then->to_string(), this->else_->to_string());
 }
 
-llvm::Value *NumberExprAST::codegen() {
+std::string BlockExprAST::to_string() const {
+  std::string str;
+  for (auto &i : exprs) {
+    str += i->to_string() + "; ";
+  }
+  if (!str.empty()) {
+    str.resize(str.size() - 2);
+  }
+  return std::format("{{{}}}", str);
+}
+std::string VarExprAST::to_string() const {
+  return std::format("var {} = {}", this->var.name, this->init->to_string());
+}
+std::string AssignExprAST::to_string() const {
+  return std::format("{} = {}", this->name, this->value->to_string());
+}
+std::string WhileExprAST::to_string() const {
+  return std::format("while ({}) {}", this->condition->to_string(),
+                     this->body->to_string());
+}
+std::string ForExprAST::to_string() const {
+  return std::format("for {} = {}, {}, {} {}", this->var.name,
+                     this->start->to_string(), this->condition->to_string(),
+                     this->step ? this->step->to_string() : "1",
+                     this->body->to_string());
+}
+std::string IndexExprAST::to_string() const {
+  if (value) {
+    return std::format("{}[{}] = {}", this->name, this->index->to_string(),
+                       this->value->to_string());
+  }
+  return std::format("{}[{}]", this->name, this->index->to_string());
+}
+std::string ParExprAST::to_string() const {
+  return std::format("par({})", this->expr->to_string());
+}
+std::string ModuleAST::to_string() const {
+  std::string str;
+  for (auto &i : externs) {
+    str += i->to_string() + "\n";
+  }
+  for (auto &i : functions) {
+    str += i->to_string() + "\n";
+  }
+  return str;
+}
+
+void ExprAST::walk(const std::function<void(ExprAST &)> &fn) {
+  fn(*this);
+  children([&](ExprAST &child) { child.walk(fn); });
+}
+void BinaryExprAST::children(const std::function<void(ExprAST &)> &fn) {
+  fn(*lhs);
+  fn(*rhs);
+}
+void CallExprAST::children(const std::function<void(ExprAST &)> &fn) {
+  for (auto &i : arguments) {
+    fn(*i);
+  }
+}
+void FunctionAST::children(const std::function<void(ExprAST &)> &fn) {
+  fn(*body);
+}
+void IfElseExprAST::children(const std::function<void(ExprAST &)> &fn) {
+  fn(*condition);
+  fn(*then);
+  fn(*else_);
+}
+void BlockExprAST::children(const std::function<void(ExprAST &)> &fn) {
+  for (auto &i : exprs) {
+    fn(*i);
+  }
+}
+void VarExprAST::children(const std::function<void(ExprAST &)> &fn) {
+  fn(*init);
+}
+void AssignExprAST::children(const std::function<void(ExprAST &)> &fn) {
+  fn(*value);
+}
+void WhileExprAST::children(const std::function<void(ExprAST &)> &fn) {
+  fn(*condition);
+  fn(*body);
+}
+void ForExprAST::children(const std::function<void(ExprAST &)> &fn) {
+  fn(*start);
+  fn(*condition);
+  if (step) {
+    fn(*step);
+  }
+  fn(*body);
+}
+void IndexExprAST::children(const std::function<void(ExprAST &)> &fn) {
+  fn(*index);
+  if (value) {
+    fn(*value);
+  }
+}
+void ParExprAST::children(const std::function<void(ExprAST &)> &fn) {
+  fn(*expr);
+}
+
+bool BinaryExprAST::mayTrap() const {
+  if (opcode != OpType::DIV || type == Type::Double) {
+    return false;
+  }
+  auto divisor = dynamic_cast<IntegerExprAST *>(rhs.get());
+  return !divisor || divisor->getValue() == 0 || divisor->getValue() == -1;
+}
+bool BinaryExprAST::speculatable() const {
+  return !mayTrap() && lhs->speculatable() && rhs->speculatable();
+}
+bool IfElseExprAST::speculatable() const {
+  return condition->speculatable() && then->speculatable() &&
+         else_->speculatable();
+}
+bool BlockExprAST::speculatable() const {
+  for (auto &i : exprs) {
+    if (!i->speculatable()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+unsigned BinaryExprAST::cost() const {
+  // a division takes several times longer than other arithmetic
+  unsigned op = opcode == OpType::DIV ? 4 : 1;
+  return op + lhs->cost() + rhs->cost();
+}
+unsigned IfElseExprAST::cost() const {
+  // as a select, both arms are evaluated
+  return 1 + condition->cost() + then->cost() + else_->cost();
+}
+unsigned BlockExprAST::cost() const {
+  unsigned cost = 0;
+  for (auto &i : exprs) {
+    cost += i->cost();
+  }
+  return cost;
+}
+
+void BlockExprAST::setTail(bool tail) {
+  for (auto &i : exprs) {
+    i->setTail(tail && &i == &exprs.back());
+  }
+}
+void IfElseExprAST::setTail(bool tail) {
+  this->tail = tail;
+  then->setTail(tail);
+  else_->setTail(tail);
+}
+
+Type join(Type a, Type b) { return std::max(a, b); }
+llvm::Type *toLLVMType(Type type) {
+  switch (type) {
+  case Type::Int:
+    return llvm::Type::getInt64Ty(*TheContext);
+  case Type::Array:
+    // passed to and from the host as a (data, length) pair
+    return llvm::StructType::get(
+        *TheContext, {llvm::PointerType::getUnqual(*TheContext),
+                      llvm::Type::getInt64Ty(*TheContext)});
+  default:
+    return llvm::Type::getDoubleTy(*TheContext);
+  }
+}
+llvm::Value *castTo(llvm::Value *v, llvm::Type *type) {
+  auto from = v->getType();
+  if (from == type) {
+    return v;
+  }
+  if (from->isStructTy() || type->isStructTy()) {
+    LOG_ERROR("Arrays cannot be converted to or from scalars");
+    return nullptr;
+  }
+  if (type->isIntegerTy(1)) {
+    if (from->isDoubleTy()) {
+      return Builder->CreateFCmpONE(v, llvm::ConstantFP::get(from, 0.0));
+    }
+    return Builder->CreateICmpNE(v, llvm::ConstantInt::get(from, 0));
+  }
+  if (from->isIntegerTy(1)) {
+    return type->isDoubleTy() ? Builder->CreateUIToFP(v, type)
+                              : Builder->CreateZExt(v, type);
+  }
+  if (from->isDoubleTy()) {
+    return Builder->CreateFPToSI(v, type);
+  }
+  return Builder->CreateSIToFP(v, type);
+}
+
+// branch to a trap unless ok, which is expected to hold
+static void trapUnless(llvm::Value *ok, const std::string &check) {
+  auto func = Builder->GetInsertBlock()->getParent();
+  auto okBB = llvm::BasicBlock::Create(*TheContext, check + ".ok", func);
+  auto failBB = llvm::BasicBlock::Create(*TheContext, check + ".fail", func);
+  Builder->CreateCondBr(
+      ok, okBB, failBB,
+      llvm::MDBuilder(*TheContext).createBranchWeights(1 << 20, 1));
+  Builder->SetInsertPoint(failBB);
+  auto trap = TheModule->getOrInsertFunction(
+      "llvm.trap", llvm::Type::getVoidTy(*TheContext));
+  Builder->CreateCall(trap);
+  Builder->CreateUnreachable();
+  Builder->SetInsertPoint(okBB);
+}
+// sdiv is undefined where BinaryExprAST::mayTrap says, trap there instead
+static llvm::Value *checkedSDiv(llvm::Value *l, llvm::Value *r) {
+  auto type = l->getType();
+  auto divisor = llvm::dyn_cast<llvm::ConstantInt>(r);
+  if (!divisor || divisor->isZero() || divisor->isMinusOne()) {
+    auto min = llvm::ConstantInt::get(
+        type, llvm::APInt::getSignedMinValue(type->getIntegerBitWidth()));
+    auto overflow =
+        Builder->CreateAnd(Builder->CreateICmpEQ(l, min),
+                           Builder->CreateICmpEQ(
+                               r, llvm::ConstantInt::getSigned(type, -1)));
+    auto zero = Builder->CreateICmpEQ(r, llvm::ConstantInt::get(type, 0));
+    trapUnless(Builder->CreateNot(Builder->CreateOr(zero, overflow)), "div");
+  }
+  return Builder->CreateSDiv(l, r);
+}
+
+llvm::AllocaInst *createEntryAlloca(llvm::Function *func,
+                                    const std::string &name, llvm::Type *type) {
+  auto &entry = func->getEntryBlock();
+  llvm::IRBuilder<> builder(&entry, entry.begin());
+  return builder.CreateAlloca(type, nullptr, name);
+}
+
+llvm::Value *NumberExprAST::codegen() { return emit(value); }
+llvm::Value *NumberExprAST::emit(double value) {
   return llvm::ConstantFP::get(*TheContext, llvm::APFloat(value));
 }
-llvm::Value *VariableExprAST::codegen() {
-  auto v = NamedValues[this->name];
+llvm::Value *IntegerExprAST::codegen() { return emit(value); }
+llvm::Value *IntegerExprAST::emit(int64_t value) {
+  return llvm::ConstantInt::getSigned(llvm::Type::getInt64Ty(*TheContext),
+                                      value);
+}
+llvm::Value *VariableExprAST::codegen() { return emit(name); }
+llvm::Value *VariableExprAST::emit(const std::string &name) {
+  auto v = NamedValues[name];
   if (!v) {
     LOG_ERROR("Unknown variable name");
+    return nullptr;
   }
-  return v;
+  return Builder->CreateLoad(v->getAllocatedType(), v, name);
 }
 llvm::Value *BinaryExprAST::codegen() {
   auto l = lhs->codegen();
@@ -62,42 +368,45 @@ llvm::Value *BinaryExprAST::codegen() {
   if (!l || !r) {
     return nullptr;
   }
-  switch (opcode) {
+  return emit(opcode, l, r);
+}
+llvm::Value *BinaryExprAST::emit(OpType op, llvm::Value *l, llvm::Value *r) {
+  if (l->getType()->isStructTy() || r->getType()->isStructTy()) {
+    LOG_ERROR("array used as a number");
+    return nullptr;
+  }
+  // operands are only converted when the types mix
+  bool fp = l->getType()->isDoubleTy() || r->getType()->isDoubleTy();
+  auto type = toLLVMType(fp ? Type::Double : Type::Int);
+  l = castTo(l, type);
+  r = castTo(r, type);
+  switch (op) {
   case OpType::ADD:
-    return Builder->CreateFAdd(l, r);
+    return fp ? Builder->CreateFAdd(l, r) : Builder->CreateAdd(l, r);
   case OpType::SUB:
-    return Builder->CreateFSub(l, r);
+    return fp ? Builder->CreateFSub(l, r) : Builder->CreateSub(l, r);
   case OpType::MUL:
-    return Builder->CreateFMul(l, r);
+    return fp ? Builder->CreateFMul(l, r) : Builder->CreateMul(l, r);
   case OpType::DIV:
-    return Builder->CreateFDiv(l, r);
+    return fp ? Builder->CreateFDiv(l, r) : checkedSDiv(l, r);
   case OpType::LT:
-    return Builder->CreateFCmpULT(l, r);
+    return fp ? Builder->CreateFCmpULT(l, r) : Builder->CreateICmpSLT(l, r);
   case OpType::LE:
-    return Builder->CreateFCmpULE(l, r);
+    return fp ? Builder->CreateFCmpULE(l, r) : Builder->CreateICmpSLE(l, r);
   case OpType::GT:
-    return Builder->CreateFCmpUGT(l, r);
+    return fp ? Builder->CreateFCmpUGT(l, r) : Builder->CreateICmpSGT(l, r);
   case OpType::GE:
-    return Builder->CreateFCmpUGE(l, r);
+    return fp ? Builder->CreateFCmpUGE(l, r) : Builder->CreateICmpSGE(l, r);
   case OpType::EQ:
-    return Builder->CreateICmpEQ(l, r);
+    return fp ? Builder->CreateFCmpOEQ(l, r) : Builder->CreateICmpEQ(l, r);
   case OpType::NE:
-    return Builder->CreateICmpNE(l, r);
+    return fp ? Builder->CreateFCmpUNE(l, r) : Builder->CreateICmpNE(l, r);
   default:
     LOG_ERROR("invalid binary operator");
   }
   return nullptr;
 }
 llvm::Value *CallExprAST::codegen() {
-  auto callee = TheModule->getFunction(this->callee);
-  if (!callee) {
-    LOG_ERROR("Unknown function referenced");
-    return nullptr;
-  }
-  if (callee->arg_size() != arguments.size()) {
-    LOG_ERROR("Incorrect arguments passed");
-    return nullptr;
-  }
   std::vector<llvm::Value *> args;
   for (auto &i : arguments) {
     auto v = i->codegen();
@@ -107,27 +416,224 @@ llvm::Value *CallExprAST::codegen() {
     }
     args.push_back(v);
   }
-  return Builder->CreateCall(callee, args);
+  debugLine(getLine());
+  return emit(callee, args);
+}
+llvm::Value *CallExprAST::emit(const std::string &callee,
+                               const std::vector<llvm::Value *> &args) {
+  auto func = TheModule->getFunction(callee);
+  if (!func && callee == "len" && args.size() == 1) {
+    if (args[0]->getType() != toLLVMType(Type::Array)) {
+      LOG_ERROR("len() expects an array");
+      return nullptr;
+    }
+    return Builder->CreateExtractValue(args[0], 1);
+  }
+  if (auto it = mathBuiltins.find(callee); !func && it != mathBuiltins.end()) {
+    if (args.size() != it->second.arity) {
+      LOG_ERROR("Incorrect arguments passed");
+      return nullptr;
+    }
+    auto doubleTy = toLLVMType(Type::Double);
+    std::vector<llvm::Value *> converted;
+    for (auto v : args) {
+      if (!(v = castTo(v, doubleTy))) {
+        return nullptr;
+      }
+      converted.push_back(v);
+    }
+    return Builder->CreateIntrinsic(it->second.id, {doubleTy}, converted);
+  }
+  if (!func && callee == "print" && args.size() == 1) {
+    auto type = args[0]->getType();
+    if (type == toLLVMType(Type::Array)) {
+      LOG_ERROR("print() expects a scalar");
+      return nullptr;
+    }
+    // comparisons print as integers
+    if (type->isIntegerTy(1)) {
+      type = toLLVMType(Type::Int);
+    }
+    auto name = type->isDoubleTy() ? "toy_print_double" : "toy_print_int";
+    auto print = llvm::cast<llvm::Function>(
+        TheModule->getOrInsertFunction(name, type, type).getCallee());
+    // only the runtime's buffer is written
+    print->setMemoryEffects(llvm::MemoryEffects::inaccessibleMemOnly());
+    print->setDoesNotThrow();
+    print->setWillReturn();
+    return Builder->CreateCall(print, castTo(args[0], type));
+  }
+  if (!func) {
+    LOG_ERROR("Unknown function referenced");
+    return nullptr;
+  }
+  auto converted = lower(func, args);
+  if (!converted) {
+    return nullptr;
+  }
+  auto call = Builder->CreateCall(func, *converted);
+  call->setCallingConv(func->getCallingConv());
+  return call;
+}
+std::optional<std::vector<llvm::Value *>>
+CallExprAST::lower(llvm::Function *func,
+                   const std::vector<llvm::Value *> &args) {
+  // array arguments are split into their data pointer and length
+  auto arity = func->arg_size();
+  for (auto &i : func->args()) {
+    arity -= i.getType()->isPointerTy();
+  }
+  if (arity != args.size()) {
+    LOG_ERROR("Incorrect arguments passed");
+    return std::nullopt;
+  }
+  std::vector<llvm::Value *> converted;
+  auto param = func->arg_begin();
+  for (auto v : args) {
+    if (param->getType()->isPointerTy()) {
+      if (v->getType() != toLLVMType(Type::Array)) {
+        LOG_ERROR("Expected an array argument");
+        return std::nullopt;
+      }
+      converted.push_back(Builder->CreateExtractValue(v, 0));
+      converted.push_back(Builder->CreateExtractValue(v, 1));
+      param += 2;
+      continue;
+    }
+    if (!(v = castTo(v, param->getType()))) {
+      return std::nullopt;
+    }
+    converted.push_back(v);
+    ++param;
+  }
+  return converted;
 }
 llvm::Function *PrototypeAST::codegen() {
-  std::vector<llvm::Type *> doubleArgs(arguments.size(),
-                                       llvm::Type::getDoubleTy(*TheContext));
-  auto funcType = llvm::FunctionType::get(llvm::Type::getDoubleTy(*TheContext),
-                                          doubleArgs, false);
+  if (ret.type == Type::Array) {
+    LOG_ERROR("Functions cannot return arrays");
+    return nullptr;
+  }
+  std::vector<llvm::Type *> argTypes;
+  for (auto &i : arguments) {
+    if (i.type == Type::Array) {
+      argTypes.push_back(llvm::PointerType::getUnqual(*TheContext));
+      argTypes.push_back(llvm::Type::getInt64Ty(*TheContext));
+    } else {
+      argTypes.push_back(toLLVMType(i.type));
+    }
+  }
+  auto funcType =
+      llvm::FunctionType::get(toLLVMType(ret.type), argTypes, false);
 
-  auto func = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage,
-                                     name, TheModule.get());
-  int i = 0;
-  for (auto &arg : func->args()) {
-    arg.setName(arguments[i++]);
+  auto func = llvm::Function::Create(
+      funcType,
+      internal ? llvm::Function::InternalLinkage
+               : llvm::Function::ExternalLinkage,
+      name, TheModule.get());
+  if (internal) {
+    func->setCallingConv(llvm::CallingConv::Fast);
+  }
+  auto arg = func->arg_begin();
+  for (auto &i : arguments) {
+    if (i.type == Type::Array) {
+      (arg++)->setName(i.name + ".data");
+      (arg++)->setName(i.name + ".len");
+    } else {
+      (arg++)->setName(i.name);
+    }
+  }
+  if (effects.memory != llvm::MemoryEffects::unknown()) {
+    auto memory = effects.memory;
+    if (getReportMode() == ReportMode::Instrument) {
+      // the hooks write the runtime's counters, the function's id is read
+      memory |= llvm::MemoryEffects::inaccessibleMemOnly() |
+                llvm::MemoryEffects(llvm::IRMemLocation::Other,
+                                    llvm::ModRefInfo::Ref);
+    }
+    func->setMemoryEffects(memory);
+  }
+  if (effects.nounwind) {
+    func->setDoesNotThrow();
+  }
+  if (effects.willreturn) {
+    func->addFnAttr(llvm::Attribute::WillReturn);
   }
   return func;
 }
 const std::string &PrototypeAST::getName() const { return name; }
+bool PrototypeAST::isAttribute(const std::string &name) {
+  static const std::unordered_set<std::string> known{
+      "pure", "readonly", "memo", "contract", "fast"};
+  return known.contains(name);
+}
+void PrototypeAST::setAttributes(std::vector<std::string> attrs) {
+  attributes = std::move(attrs);
+  if (hasAttribute("pure")) {
+    bool arrays = std::any_of(arguments.begin(), arguments.end(),
+                              [](auto &i) { return i.type == Type::Array; });
+    effects.memory = arrays ? llvm::MemoryEffects::argMemOnly(
+                                  llvm::ModRefInfo::Ref)
+                            : llvm::MemoryEffects::none();
+  } else if (hasAttribute("readonly")) {
+    effects.memory = llvm::MemoryEffects::readOnly();
+  }
+  if (hasDeclaredEffects()) {
+    effects.nounwind = effects.willreturn = true;
+  }
+}
+bool PrototypeAST::hasAttribute(const std::string &name) const {
+  return std::find(attributes.begin(), attributes.end(), name) !=
+         attributes.end();
+}
+bool PrototypeAST::hasDeclaredEffects() const {
+  return hasAttribute("pure") || hasAttribute("readonly");
+}
+PrototypeAST::FPModel PrototypeAST::getFPModel() const {
+  auto model = fpModel;
+  if (hasAttribute("contract")) {
+    model = std::max(model, FPModel::Contract);
+  }
+  if (hasAttribute("fast")) {
+    model = FPModel::Fast;
+  }
+  return model;
+}
+void PrototypeAST::applyFPModel(llvm::Function *func) const {
+  llvm::FastMathFlags flags;
+  switch (getFPModel()) {
+  case FPModel::Fast:
+    flags.setFast();
+    // the backend reads these rather than the flags of each instruction
+    func->addFnAttr("unsafe-fp-math", "true");
+    func->addFnAttr("no-nans-fp-math", "true");
+    func->addFnAttr("no-infs-fp-math", "true");
+    func->addFnAttr("no-signed-zeros-fp-math", "true");
+    func->addFnAttr("approx-func-fp-math", "true");
+    break;
+  case FPModel::Contract:
+    flags.setAllowContract();
+    break;
+  case FPModel::Strict:
+    break;
+  }
+  Builder->setFastMathFlags(flags);
+}
 llvm::Function *FunctionAST::codegen() {
-  auto func = TheModule->getFunction(proto->getName());
+  auto func = begin(*proto);
+  if (!func) {
+    return nullptr;
+  }
+  body->setTail(true);
+  func = finish(func, this->body->codegen());
+  if (func && proto->isMemoized()) {
+    return memoize(func);
+  }
+  return func;
+}
+llvm::Function *FunctionAST::begin(PrototypeAST &proto) {
+  auto func = TheModule->getFunction(proto.getName());
   if (!func) {
-    func = proto->codegen();
+    func = proto.codegen();
   }
   if (!func) {
     return nullptr;
@@ -138,14 +644,30 @@ llvm::Function *FunctionAST::codegen() {
   }
   auto bb = llvm::BasicBlock::Create(*TheContext, "entry", func);
   Builder->SetInsertPoint(bb);
+  debugFunction(func, proto.getLine());
+  proto.applyFPModel(func);
 
   NamedValues.clear();
-  for (auto &arg : func->args()) {
-    NamedValues[arg.getName().str()] = &arg;
+  auto arg = func->arg_begin();
+  for (auto &i : proto.getArguments()) {
+    llvm::Value *v = arg++;
+    if (v->getType()->isPointerTy()) {
+      auto array = llvm::PoisonValue::get(toLLVMType(Type::Array));
+      v = Builder->CreateInsertValue(array, v, 0);
+      v = Builder->CreateInsertValue(v, arg++, 1);
+    }
+    auto alloca = createEntryAlloca(func, i.name, v->getType());
+    Builder->CreateStore(v, alloca);
+    NamedValues[i.name] = alloca;
   }
-
-  if (auto ret = this->body->codegen()) {
-    Builder->CreateRet(ret);
+  profileFunction(func, proto.getName());
+  reportEnter(proto.getName());
+  return func;
+}
+llvm::Function *FunctionAST::finish(llvm::Function *func, llvm::Value *ret) {
+  auto done = ret && emitReturn(ret);
+  endDebugFunction();
+  if (done) {
     llvm::verifyFunction(*func);
     return func;
   }
@@ -153,40 +675,516 @@ llvm::Function *FunctionAST::codegen() {
   func->eraseFromParent();
   return nullptr;
 }
+llvm::Value *FunctionAST::emitReturn(llvm::Value *v) {
+  auto bb = Builder->GetInsertBlock();
+  if (bb->getTerminator()) {
+    return v;
+  }
+  auto func = bb->getParent();
+  auto ret = castTo(v, func->getReturnType());
+  if (!ret) {
+    return nullptr;
+  }
+  // an exit hook between a call and the return keeps it from being a tail
+  // call
+  reportExit();
+  auto call = llvm::dyn_cast<llvm::CallInst>(ret);
+  if (call && call->getCalledFunction() == func && call == &bb->back()) {
+    call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+  }
+  return Builder->CreateRet(ret);
+}
+bool IfElseExprAST::selectable() const {
+  if (strategy == Strategy::Branch || !then->speculatable() ||
+      !else_->speculatable()) {
+    return false;
+  }
+  return strategy == Strategy::Select ||
+         then->cost() + else_->cost() <= selectBudget;
+}
 llvm::Value *IfElseExprAST::codegen() {
+  if (selectable()) {
+    return emitSelect();
+  }
   auto cond = condition->codegen();
   if (!cond)
     return nullptr;
-  cond = Builder->CreateFCmpONE(
-      cond, llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0)));
-
-  auto func = Builder->GetInsertBlock()->getParent();
-  auto thenBB = llvm::BasicBlock::Create(*TheContext, "then", func);
-  auto elseBB = llvm::BasicBlock::Create(*TheContext, "else", func);
-  auto mergeBB = llvm::BasicBlock::Create(*TheContext, "merge", func);
-  Builder->CreateCondBr(cond, thenBB, elseBB);
+  auto condBr = emitCond(cond);
+  if (!condBr) {
+    return nullptr;
+  }
+  if (tail) {
+    // each arm returns, there is nothing to merge
+    auto tv = then->codegen();
+    if (!tv || !FunctionAST::emitReturn(tv)) {
+      return nullptr;
+    }
+    Builder->SetInsertPoint(condBr->getSuccessor(1));
+    auto ev = else_->codegen();
+    return ev ? FunctionAST::emitReturn(ev) : nullptr;
+  }
 
-  Builder->SetInsertPoint(thenBB);
   auto tv = this->then->codegen();
   if (!tv) {
     return nullptr;
   }
-  Builder->CreateBr(mergeBB);
-  thenBB = Builder->GetInsertBlock();
+  auto thenBr = emitElse(condBr);
 
-  Builder->SetInsertPoint(elseBB);
   auto ev = this->else_->codegen();
   if (!ev) {
     return nullptr;
   }
+  return emitMerge(thenBr, tv, ev);
+}
+llvm::Value *IfElseExprAST::emitSelect() {
+  auto cond = condition->codegen();
+  if (!cond ||
+      !(cond = castTo(cond, llvm::Type::getInt1Ty(*TheContext)))) {
+    return nullptr;
+  }
+  auto site = profileBranch();
+  profileSelect(site, cond);
+  auto tv = then->codegen();
+  auto ev = else_->codegen();
+  if (!tv || !ev) {
+    return nullptr;
+  }
+  if (tv->getType() != ev->getType()) {
+    bool fp = tv->getType()->isDoubleTy() || ev->getType()->isDoubleTy();
+    auto type = toLLVMType(fp ? Type::Double : Type::Int);
+    tv = castTo(tv, type);
+    ev = castTo(ev, type);
+    if (!tv || !ev) {
+      return nullptr;
+    }
+  }
+  auto select = Builder->CreateSelect(cond, tv, ev);
+  if (auto inst = llvm::dyn_cast<llvm::Instruction>(select)) {
+    inst->setMetadata(llvm::LLVMContext::MD_prof, profileWeights(site));
+  }
+  return select;
+}
+llvm::BranchInst *IfElseExprAST::emitCond(llvm::Value *cond) {
+  cond = castTo(cond, llvm::Type::getInt1Ty(*TheContext));
+  if (!cond) {
+    return nullptr;
+  }
+
+  auto func = Builder->GetInsertBlock()->getParent();
+  auto thenBB = llvm::BasicBlock::Create(*TheContext, "then", func);
+  auto elseBB = llvm::BasicBlock::Create(*TheContext, "else", func);
+  auto site = profileBranch();
+  auto condBr = Builder->CreateCondBr(cond, thenBB, elseBB,
+                                      profileWeights(site));
+  Builder->SetInsertPoint(elseBB);
+  profileArm(site, false);
+  Builder->SetInsertPoint(thenBB);
+  profileArm(site, true);
+  return condBr;
+}
+llvm::BranchInst *IfElseExprAST::emitElse(llvm::BranchInst *condBr) {
+  auto func = Builder->GetInsertBlock()->getParent();
+  auto mergeBB = llvm::BasicBlock::Create(*TheContext, "merge", func);
+  auto thenBr = Builder->CreateBr(mergeBB);
+  Builder->SetInsertPoint(condBr->getSuccessor(1));
+  return thenBr;
+}
+llvm::Value *IfElseExprAST::emitMerge(llvm::BranchInst *thenBr, llvm::Value *tv,
+                                      llvm::Value *ev) {
+  auto mergeBB = thenBr->getSuccessor(0);
+  auto elseBB = Builder->GetInsertBlock();
+  // the arms may disagree on their type, widen both to the join
+  auto type = tv->getType();
+  if (type != ev->getType()) {
+    bool fp = type->isDoubleTy() || ev->getType()->isDoubleTy();
+    type = toLLVMType(fp ? Type::Double : Type::Int);
+    ev = castTo(ev, type);
+    Builder->SetInsertPoint(thenBr);
+    tv = castTo(tv, type);
+    Builder->SetInsertPoint(elseBB);
+    if (!tv || !ev) {
+      return nullptr;
+    }
+  }
   Builder->CreateBr(mergeBB);
-  elseBB = Builder->GetInsertBlock();
 
   Builder->SetInsertPoint(mergeBB);
-  auto phi = Builder->CreatePHI(llvm::Type::getDoubleTy(*TheContext), 2);
-  phi->addIncoming(tv, thenBB);
+  auto phi = Builder->CreatePHI(type, 2);
+  phi->addIncoming(tv, thenBr->getParent());
   phi->addIncoming(ev, elseBB);
   return phi;
 }
 
+llvm::Value *BlockExprAST::codegen() {
+  auto scope = NamedValues;
+  llvm::Value *v = nullptr;
+  for (auto &i : exprs) {
+    debugLine(i->getLine());
+    if (!(v = i->codegen())) {
+      break;
+    }
+  }
+  NamedValues = std::move(scope);
+  return v;
+}
+llvm::Value *VarExprAST::codegen() {
+  auto v = init->codegen();
+  if (!v) {
+    return nullptr;
+  }
+  auto func = Builder->GetInsertBlock()->getParent();
+  auto alloca = createEntryAlloca(func, var.name, toLLVMType(var.type));
+  if (!(v = castTo(v, alloca->getAllocatedType()))) {
+    return nullptr;
+  }
+  Builder->CreateStore(v, alloca);
+  NamedValues[var.name] = alloca;
+  return v;
+}
+llvm::Value *AssignExprAST::codegen() {
+  auto alloca = NamedValues[name];
+  if (!alloca) {
+    LOG_ERROR("Unknown variable name");
+    return nullptr;
+  }
+  if (alloca->getAllocatedType() == toLLVMType(Type::Array)) {
+    LOG_ERROR("Arrays cannot be reassigned");
+    return nullptr;
+  }
+  auto v = value->codegen();
+  if (!v || !(v = castTo(v, alloca->getAllocatedType()))) {
+    return nullptr;
+  }
+  Builder->CreateStore(v, alloca);
+  return v;
+}
+llvm::Value *WhileExprAST::codegen() {
+  auto func = Builder->GetInsertBlock()->getParent();
+  auto condBB = llvm::BasicBlock::Create(*TheContext, "while.cond", func);
+  auto bodyBB = llvm::BasicBlock::Create(*TheContext, "while.body", func);
+  auto afterBB = llvm::BasicBlock::Create(*TheContext, "while.end", func);
+  Builder->CreateBr(condBB);
+
+  Builder->SetInsertPoint(condBB);
+  auto cond = condition->codegen();
+  if (!cond) {
+    return nullptr;
+  }
+  if (!(cond = castTo(cond, llvm::Type::getInt1Ty(*TheContext)))) {
+    return nullptr;
+  }
+  Builder->CreateCondBr(cond, bodyBB, afterBB);
+
+  Builder->SetInsertPoint(bodyBB);
+  if (!body->codegen()) {
+    return nullptr;
+  }
+  Builder->CreateBr(condBB);
+
+  Builder->SetInsertPoint(afterBB);
+  return IntegerExprAST::emit(0);
+}
+llvm::Value *ForExprAST::codegen() {
+  auto func = Builder->GetInsertBlock()->getParent();
+  auto v = start->codegen();
+  if (!v) {
+    return nullptr;
+  }
+  auto alloca = createEntryAlloca(func, var.name, toLLVMType(var.type));
+  if (!(v = castTo(v, alloca->getAllocatedType()))) {
+    return nullptr;
+  }
+  Builder->CreateStore(v, alloca);
+  markInBounds();
+  auto shadowed = NamedValues[var.name];
+  NamedValues[var.name] = alloca;
+
+  auto condBB = llvm::BasicBlock::Create(*TheContext, "for.cond", func);
+  auto bodyBB = llvm::BasicBlock::Create(*TheContext, "for.body", func);
+  auto afterBB = llvm::BasicBlock::Create(*TheContext, "for.end", func);
+  Builder->CreateBr(condBB);
+
+  Builder->SetInsertPoint(condBB);
+  auto cond = condition->codegen();
+  if (!cond) {
+    return nullptr;
+  }
+  if (!(cond = castTo(cond, llvm::Type::getInt1Ty(*TheContext)))) {
+    return nullptr;
+  }
+  Builder->CreateCondBr(cond, bodyBB, afterBB);
+
+  Builder->SetInsertPoint(bodyBB);
+  if (!body->codegen()) {
+    return nullptr;
+  }
+  auto s = step ? step->codegen() : IntegerExprAST::emit(1);
+  if (!s) {
+    return nullptr;
+  }
+  auto cur = Builder->CreateLoad(alloca->getAllocatedType(), alloca, var.name);
+  auto next = BinaryExprAST::emit(BinaryExprAST::OpType::ADD, cur, s);
+  if (!next || !(next = castTo(next, alloca->getAllocatedType()))) {
+    return nullptr;
+  }
+  Builder->CreateStore(next, alloca);
+  Builder->CreateBr(condBB);
+
+  Builder->SetInsertPoint(afterBB);
+  NamedValues[var.name] = shadowed;
+  return IntegerExprAST::emit(0);
+}
+void ForExprAST::markInBounds() {
+  // for i = <non-negative literal>, i < len(a)[, <positive literal>]
+  // An array of doubles has fewer than 2^60 elements, so with a step of at
+  // most 2^32 i + step cannot wrap around to a negative index.
+  constexpr int64_t maxStep = int64_t{1} << 32;
+  auto init = dynamic_cast<IntegerExprAST *>(start.get());
+  auto inc = step ? dynamic_cast<IntegerExprAST *>(step.get()) : nullptr;
+  auto cmp = dynamic_cast<BinaryExprAST *>(condition.get());
+  if (!init || init->getValue() < 0
+      || (step && (!inc || inc->getValue() <= 0 || inc->getValue() > maxStep))
+      || !cmp || cmp->getOpcode() != BinaryExprAST::OpType::LT) {
+    return;
+  }
+  auto lhs = dynamic_cast<VariableExprAST *>(&cmp->getLHS());
+  auto len = dynamic_cast<CallExprAST *>(&cmp->getRHS());
+  if (!lhs || lhs->getName() != var.name || !len || len->getCallee() != "len"
+      || len->getArguments().size() != 1 || TheModule->getFunction("len")) {
+    return;
+  }
+  auto array = dynamic_cast<VariableExprAST *>(len->getArguments()[0].get());
+  if (!array) {
+    return;
+  }
+  // neither binding may change inside the body
+  bool invariant = true;
+  std::vector<IndexExprAST *> accesses;
+  body->walk([&](ExprAST &e) {
+    std::string bound;
+    if (auto v = dynamic_cast<VarExprAST *>(&e)) {
+      bound = v->getName();
+    } else if (auto a = dynamic_cast<AssignExprAST *>(&e)) {
+      bound = a->getName();
+    } else if (auto f = dynamic_cast<ForExprAST *>(&e)) {
+      bound = f->getVarName();
+    } else if (auto i = dynamic_cast<IndexExprAST *>(&e)) {
+      auto index = dynamic_cast<VariableExprAST *>(&i->getIndex());
+      if (i->getName() == array->getName() && index
+          && index->getName() == var.name) {
+        accesses.push_back(i);
+      }
+    }
+    if (bound == var.name || bound == array->getName()) {
+      invariant = false;
+    }
+  });
+  if (!invariant) {
+    return;
+  }
+  for (auto i : accesses) {
+    i->setInBounds();
+  }
+}
+llvm::Value *IndexExprAST::codegen() {
+  auto alloca = NamedValues[name];
+  auto arrayType = toLLVMType(Type::Array);
+  if (!alloca || alloca->getAllocatedType() != arrayType) {
+    LOG_ERROR("Indexing a non-array value");
+    return nullptr;
+  }
+  auto idx = index->codegen();
+  if (!idx || !(idx = castTo(idx, llvm::Type::getInt64Ty(*TheContext)))) {
+    return nullptr;
+  }
+  auto array = Builder->CreateLoad(arrayType, alloca, name);
+  if (!inBounds) {
+    // unsigned compare also rejects negative indices
+    auto len = Builder->CreateExtractValue(array, 1, name + ".len");
+    trapUnless(Builder->CreateICmpULT(idx, len), "bounds");
+  }
+  auto data = Builder->CreateExtractValue(array, 0, name + ".data");
+  auto doubleTy = llvm::Type::getDoubleTy(*TheContext);
+  auto ptr = Builder->CreateInBoundsGEP(doubleTy, data, idx);
+  if (!value) {
+    return Builder->CreateLoad(doubleTy, ptr);
+  }
+  auto v = this->value->codegen();
+  if (!v || !(v = castTo(v, doubleTy))) {
+    return nullptr;
+  }
+  Builder->CreateStore(v, ptr);
+  return v;
+}
+llvm::Function *FunctionAST::codegenBatch() {
+  auto &args = proto->getArguments();
+  for (auto &i : args) {
+    if (i.type == Type::Array) {
+      LOG_ERROR("Batch kernels only take scalar parameters");
+      return nullptr;
+    }
+  }
+  auto name = proto->getName() + "_batch";
+  if (TheModule->getFunction(name)) {
+    LOG_ERROR("Function cannot be redefined.");
+    return nullptr;
+  }
+  auto ptrTy = llvm::PointerType::getUnqual(*TheContext);
+  auto i64 = llvm::Type::getInt64Ty(*TheContext);
+  auto doubleTy = llvm::Type::getDoubleTy(*TheContext);
+  auto funcType = llvm::FunctionType::get(llvm::Type::getVoidTy(*TheContext),
+                                          {ptrTy, ptrTy, i64}, false);
+  auto func = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage,
+                                     name, TheModule.get());
+  auto cols = func->getArg(0);
+  auto out = func->getArg(1);
+  auto n = func->getArg(2);
+  cols->setName("cols");
+  out->setName("out");
+  n->setName("n");
+
+  auto entry = llvm::BasicBlock::Create(*TheContext, "entry", func);
+  Builder->SetInsertPoint(entry);
+  proto->applyFPModel(func);
+  // the column base pointers are loop invariant
+  std::vector<llvm::Value *> columns;
+  for (size_t i = 0; i < args.size(); i++) {
+    auto col = Builder->CreateConstInBoundsGEP1_64(ptrTy, cols, i);
+    columns.push_back(Builder->CreateLoad(ptrTy, col, args[i].name + ".col"));
+  }
+  auto counter = createEntryAlloca(func, "k", i64);
+  Builder->CreateStore(llvm::ConstantInt::get(i64, 0), counter);
+
+  auto condBB = llvm::BasicBlock::Create(*TheContext, "batch.cond", func);
+  auto bodyBB = llvm::BasicBlock::Create(*TheContext, "batch.body", func);
+  auto endBB = llvm::BasicBlock::Create(*TheContext, "batch.end", func);
+  Builder->CreateBr(condBB);
+
+  Builder->SetInsertPoint(condBB);
+  auto k = Builder->CreateLoad(i64, counter, "k");
+  Builder->CreateCondBr(Builder->CreateICmpULT(k, n), bodyBB, endBB);
+
+  Builder->SetInsertPoint(bodyBB);
+  k = Builder->CreateLoad(i64, counter, "k");
+  NamedValues.clear();
+  for (size_t i = 0; i < args.size(); i++) {
+    auto ptr = Builder->CreateInBoundsGEP(doubleTy, columns[i], k);
+    llvm::Value *v = Builder->CreateLoad(doubleTy, ptr, args[i].name);
+    v = castTo(v, toLLVMType(args[i].type));
+    auto alloca = createEntryAlloca(func, args[i].name, v->getType());
+    Builder->CreateStore(v, alloca);
+    NamedValues[args[i].name] = alloca;
+  }
+  // same if/else numbering as the scalar function, for its weights
+  profileFunction(func, proto->getName(), false);
+  // the body is inlined into the loop, its arms must not return
+  body->setTail(false);
+  // a branch-free loop body vectorizes, unless branches are forced; the
+  // strategy is this thread's, no other compile sees the change
+  auto saved = IfElseExprAST::strategy;
+  if (saved == IfElseExprAST::Strategy::Auto) {
+    IfElseExprAST::strategy = IfElseExprAST::Strategy::Select;
+  }
+  auto ret = body->codegen();
+  IfElseExprAST::strategy = saved;
+  if (!ret || !(ret = castTo(ret, doubleTy))) {
+    func->eraseFromParent();
+    return nullptr;
+  }
+  Builder->CreateStore(ret, Builder->CreateInBoundsGEP(doubleTy, out, k));
+  auto next = Builder->CreateAdd(k, llvm::ConstantInt::get(i64, 1), "k.next",
+                                 /*HasNUW=*/true);
+  Builder->CreateStore(next, counter);
+  Builder->CreateBr(condBB);
+
+  Builder->SetInsertPoint(endBB);
+  Builder->CreateRetVoid();
+  llvm::verifyFunction(*func);
+  return func;
+}
+
+bool PrototypeAST::isMathBuiltin() const {
+  auto arity = mathArity(name);
+  return arity && arity == arguments.size();
+}
+
+void ModuleAST::addExtern(PrototypeAST *proto) {
+  // calls of a math builtin are lowered without a declaration
+  if (!proto->isMathBuiltin() && !prototypes.contains(proto->getName())) {
+    prototypes[proto->getName()] = proto;
+  }
+  externs.emplace_back(proto);
+}
+void ModuleAST::addFunction(FunctionAST *func) {
+  // a definition takes precedence over an earlier extern declaration
+  prototypes[func->getProto().getName()] = &func->getProto();
+  functions.emplace_back(func);
+}
+void ModuleAST::append(ModuleAST &&other) {
+  // externs and definitions override each other the same way in any
+  // interleaving, as long as each keeps its order
+  for (auto &i : other.externs) {
+    addExtern(i.release());
+  }
+  for (auto &i : other.functions) {
+    addFunction(i.release());
+  }
+  other.externs.clear();
+  other.functions.clear();
+  other.prototypes.clear();
+}
+PrototypeAST *ModuleAST::getPrototype(const std::string &name) const {
+  auto it = prototypes.find(name);
+  return it == prototypes.end() ? nullptr : it->second;
+}
+bool ModuleAST::codegen() {
+  if (!inferTypes()) {
+    return false;
+  }
+  if (specializeGrowth) {
+    // the clones' remaining parameters are typed, their bodies are not
+    specialize();
+    if (!inferTypes()) {
+      return false;
+    }
+  }
+  inferEffects();
+  if (!chooseMemoized()) {
+    return false;
+  }
+  // declare everything first so that calls may refer to later definitions
+  for (auto &i : externs) {
+    if (getPrototype(i->getName()) == i.get()) {
+      i->codegen();
+    }
+  }
+  for (auto &i : functions) {
+    if (!TheModule->getFunction(i->getProto().getName())) {
+      i->getProto().codegen();
+    }
+  }
+  if (debugInfo) {
+    beginDebugInfo(*TheModule);
+  }
+  for (auto &i : functions) {
+    if (Logger::instance().enabled(LogLevel::DEBUG)) {
+      LOG_DEBUG() << i->to_string() << '\n';
+    }
+    if (!i->codegen()) {
+      return false;
+    }
+  }
+  finishDebugInfo();
+  return true;
+}
+llvm::Function *ModuleAST::codegenBatch(const std::string &name) {
+  for (auto &i : functions) {
+    if (i->getProto().getName() == name) {
+      return i->codegenBatch();
+    }
+  }
+  LOG_ERROR("Unknown function referenced");
+  return nullptr;
+}
+
 } // namespace Toy
\ No newline at end of file
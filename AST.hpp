@@ -5,26 +5,123 @@
 #ifndef AST_HPP
 #define AST_HPP
 #include "Logger.hpp"
+#include "Serialize.hpp"
+#include "StructuralHash.hpp"
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Value.h>
+#include <llvm/Support/ModRef.h>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
-extern std::unique_ptr<llvm::LLVMContext> TheContext;
-extern std::unique_ptr<llvm::IRBuilder<>> Builder;
-extern std::unique_ptr<llvm::Module> TheModule;
-extern std::unordered_map<std::string, llvm::Value *> NamedValues;
+// the module being compiled, one per thread, as are the codegen settings
+// (the static members of the AST classes below)
+extern thread_local std::unique_ptr<llvm::LLVMContext> TheContext;
+extern thread_local std::unique_ptr<llvm::IRBuilder<>> Builder;
+extern thread_local std::unique_ptr<llvm::Module> TheModule;
+extern thread_local std::unordered_map<std::string, llvm::AllocaInst *>
+    NamedValues;
+
+void LLVMInit(const std::string &module_name);
 
 namespace Toy {
 
+// Value types, ordered so that join() of two types is their maximum:
+// Unknown is only seen while inferring, Int widens to Double when mixed.
+// Array is a host-provided `double` buffer and never converts.
+enum class Type { Unknown, Int, Double, Array };
+
+Type join(Type a, Type b);
+llvm::Type *toLLVMType(Type type);
+// implicit conversion between i1, i64 and double values
+llvm::Value *castTo(llvm::Value *v, llvm::Type *type);
+// locals live in entry block allocas so that mem2reg can promote them
+llvm::AllocaInst *createEntryAlloca(llvm::Function *func,
+                                    const std::string &name, llvm::Type *type);
+
+// The prelude: calls needing no declaration, unless the program defines a
+// function of the same name. sqrt, sin, cos, exp, exp2, log, log2, log10,
+// fabs, floor, ceil, trunc, round, pow, fmin, fmax, copysign and fma lower
+// to LLVM intrinsics on doubles, and an extern of one declares the
+// builtin. print(x) writes a scalar on a line of its own through a
+// buffered runtime and returns it, unless an extern print is declared.
+//
+// arity of a math builtin, 0 for other names
+unsigned mathArity(const std::string &name);
+
+// A named binding: function parameter, `var` or loop variable.
+struct Parameter {
+  std::string name;
+  Type type = Type::Unknown;
+  // annotated bindings keep their type, others are inferred from the values
+  // flowing into them
+  bool annotated = false;
+};
+
+// widen an inferred binding, returns whether it changed
+bool refine(Parameter &binding, Type type);
+
+// What a call may do. The default assumes anything, as for an extern
+// without attributes.
+struct Effects {
+  llvm::MemoryEffects memory = llvm::MemoryEffects::unknown();
+  bool nounwind = false;
+  bool willreturn = false;
+
+  bool operator==(const Effects &) const = default;
+  // effects of doing both
+  Effects &operator|=(const Effects &other) {
+    memory |= other.memory;
+    nounwind &= other.nounwind;
+    willreturn &= other.willreturn;
+    return *this;
+  }
+};
+
+class ModuleAST;
+class PrototypeAST;
+
+struct TypeContext {
+  ModuleAST &module;
+  std::unordered_map<std::string, Parameter *> locals;
+  bool changed = false;
+  // an array was an operand, a condition, or joined with a scalar
+  bool arrayAsNumber = false;
+};
+
 class ExprAST {
 public:
   virtual ~ExprAST() = default;
   virtual std::string to_string() const = 0;
   virtual llvm::Value *codegen() = 0;
+  virtual Type inferType(TypeContext &ctx) = 0;
+  virtual void hash(StructuralHash &h) const = 0;
+  // deep copy
+  virtual std::unique_ptr<ExprAST> clone() const = 0;
+  // binary form, see Serialize.hpp
+  virtual void serialize(ASTWriter &w) const = 0;
+  // calls fn on every direct subexpression
+  virtual void children(const std::function<void(ExprAST &)> &) {}
+  // whether evaluating this unconditionally is safe: no side effects, no
+  // calls and nothing that may trap
+  virtual bool speculatable() const { return false; }
+  // rough instruction count of a speculatable expression
+  virtual unsigned cost() const { return 1; }
+  // whether the value is what the function returns, so that if/else arms
+  // may return by themselves
+  virtual void setTail(bool) {}
+  // calls fn on this expression and all subexpressions, in pre-order
+  void walk(const std::function<void(ExprAST &)> &fn);
+  // source line of a statement, call or function definition, 0 if unknown
+  unsigned getLine() const { return line; }
+  void setLine(unsigned line) { this->line = line; }
+
+private:
+  unsigned line = 0;
 };
 
 class NumberExprAST : public ExprAST {
@@ -34,6 +131,31 @@ public:
   explicit NumberExprAST(double value) : value(value) {}
   std::string to_string() const override;
   llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  bool speculatable() const override { return true; }
+  unsigned cost() const override { return 0; }
+  double getValue() const { return value; }
+  static llvm::Value *emit(double value);
+};
+
+class IntegerExprAST : public ExprAST {
+  int64_t value;
+
+public:
+  explicit IntegerExprAST(int64_t value) : value(value) {}
+  std::string to_string() const override;
+  llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  bool speculatable() const override { return true; }
+  unsigned cost() const override { return 0; }
+  int64_t getValue() const { return value; }
+  static llvm::Value *emit(int64_t value);
 };
 
 class VariableExprAST : public ExprAST {
@@ -43,6 +165,14 @@ public:
   explicit VariableExprAST(const std::string &name) : name(name) {}
   std::string to_string() const override;
   llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  bool speculatable() const override { return true; }
+  unsigned cost() const override { return 0; }
+  const std::string &getName() const { return name; }
+  static llvm::Value *emit(const std::string &name);
 };
 
 class BinaryExprAST : public ExprAST {
@@ -54,9 +184,25 @@ public:
       : opcode(op), lhs(lhs), rhs(rhs) {}
   std::string to_string() const override;
   llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  void children(const std::function<void(ExprAST &)> &fn) override;
+  bool speculatable() const override;
+  unsigned cost() const override;
+  static llvm::Value *emit(OpType op, llvm::Value *l, llvm::Value *r);
+  // integer division traps on a zero divisor and on INT64_MIN / -1,
+  // unless the divisor is a literal that rules both out
+  bool mayTrap() const;
+  OpType getOpcode() const { return opcode; }
+  ExprAST &getLHS() const { return *lhs; }
+  ExprAST &getRHS() const { return *rhs; }
 
 private:
   OpType opcode;
+  // operand type, set by inferType()
+  Type type = Type::Unknown;
 };
 
 // class UnaryExprAST : public ExprAST {
@@ -78,18 +224,89 @@ public:
       : callee(callee), arguments(std::move(arguments)) {}
   std::string to_string() const override;
   llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  void children(const std::function<void(ExprAST &)> &fn) override;
+  const std::string &getCallee() const { return callee; }
+  void setCallee(const std::string &name) { callee = name; }
+  const std::vector<std::unique_ptr<ExprAST>> &getArguments() const {
+    return arguments;
+  }
+  std::vector<std::unique_ptr<ExprAST>> &getArguments() { return arguments; }
+  static llvm::Value *emit(const std::string &callee,
+                           const std::vector<llvm::Value *> &args);
+  // the arguments of a call to func as passed, arrays split into pointer
+  // and length, nullopt if they do not match its parameters
+  static std::optional<std::vector<llvm::Value *>>
+  lower(llvm::Function *func, const std::vector<llvm::Value *> &args);
 };
 
 class PrototypeAST : public ExprAST {
   std::string name;
-  std::vector<std::string> arguments;
+  std::vector<Parameter> arguments;
+  Parameter ret;
+  // `@name` attributes, without the @
+  std::vector<std::string> attributes;
+  Effects effects;
+  bool memoized = false;
+  bool internal = false;
 
 public:
-  PrototypeAST(const std::string &name, std::vector<std::string> arguments)
-      : name(name), arguments(std::move(arguments)) {}
+  PrototypeAST(const std::string &name, std::vector<Parameter> arguments,
+               Type retType = Type::Unknown)
+      : name(name), arguments(std::move(arguments)),
+        ret{"", retType, retType != Type::Unknown} {}
   std::string to_string() const override;
   const std::string &getName() const;
   llvm::Function *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+
+  const std::vector<Parameter> &getArguments() const { return arguments; }
+  std::vector<Parameter> &getArguments() { return arguments; }
+  Type getReturnType() const { return ret.type; }
+  // widen an inferred type, returns whether it changed
+  bool refineArgument(size_t i, Type type);
+  bool refineReturn(Type type);
+  // default remaining Unknown parameters to Double, returns whether any was
+  bool defaultArguments();
+  // fix all types, Unknown becomes Double
+  void finalizeTypes();
+
+  // attributes the parser accepts
+  static bool isAttribute(const std::string &name);
+  void setAttributes(std::vector<std::string> attrs);
+  bool hasAttribute(const std::string &name) const;
+  const std::vector<std::string> &getAttributes() const { return attributes; }
+  // @pure (reads at most its array arguments) and @readonly (reads any
+  // memory) functions return without unwinding. Their effects are declared
+  // rather than inferred.
+  bool hasDeclaredEffects() const;
+  const Effects &getEffects() const { return effects; }
+  // applied to the declaration by codegen()
+  void setEffects(const Effects &e) { effects = e; }
+  // results are cached by argument values, see FunctionAST::memoize()
+  bool isMemoized() const { return memoized; }
+  void setMemoized() { memoized = true; }
+  // an extern of a math builtin, see mathArity()
+  bool isMathBuiltin() const;
+  // only called from this module: internal linkage and fastcc
+  bool isInternal() const { return internal; }
+  void setInternal() { internal = true; }
+
+  // Floating-point semantics of the body. Strict keeps IEEE results,
+  // Contract may fuse a * b + c into an FMA, Fast may also reassociate and
+  // assume no NaNs, infinities or signed zeros. @contract and @fast loosen
+  // the module-wide model for one function.
+  enum class FPModel { Strict, Contract, Fast };
+  static inline thread_local FPModel fpModel = FPModel::Strict;
+  FPModel getFPModel() const;
+  // set the builder's fast-math flags, and func's attributes to match
+  void applyFPModel(llvm::Function *func) const;
 };
 
 class FunctionAST : public ExprAST {
@@ -100,18 +317,271 @@ public:
   FunctionAST(PrototypeAST *proto, ExprAST *body) : proto(proto), body(body) {}
   std::string to_string() const override;
   llvm::Function *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  void children(const std::function<void(ExprAST &)> &fn) override;
+  PrototypeAST &getProto() const { return *proto; }
+  ExprAST &getBody() const { return *body; }
+
+  // Companion kernel `void <name>_batch(const double **cols, double *out,
+  // size_t n)` evaluating the function over n rows of column-major input.
+  // The body is inlined into the row loop and cheap if/else arms become
+  // selects, so the loop can vectorize.
+  llvm::Function *codegenBatch();
+
+  // Streaming emission: begin() opens the entry block of a function and binds
+  // its parameters, finish() returns the body value and verifies it.
+  static llvm::Function *begin(PrototypeAST &proto);
+  static llvm::Function *finish(llvm::Function *func, llvm::Value *ret);
+  // Return v from the current function, unless every path returned
+  // already. A self call right before the return becomes musttail, so
+  // recursion in tail position runs in constant stack.
+  static llvm::Value *emitReturn(llvm::Value *v);
+
+private:
+  // Move the body to an internal <name>.impl and make <name> look the
+  // arguments up in a runtime memo table first. Every call, including the
+  // recursive ones, goes through the table.
+  llvm::Function *memoize(llvm::Function *impl);
 };
 
 class IfElseExprAST : public ExprAST {
   std::unique_ptr<ExprAST> condition;
   std::unique_ptr<ExprAST> then;
   std::unique_ptr<ExprAST> else_;
+  bool tail = false;
 
 public:
   IfElseExprAST(ExprAST *condition, ExprAST *then, ExprAST *else_)
       : condition(condition), then(then), else_(else_) {}
   std::string to_string() const override;
   llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  void children(const std::function<void(ExprAST &)> &fn) override;
+  bool speculatable() const override;
+  unsigned cost() const override;
+  void setTail(bool tail) override;
+
+  // how to lower if/else whose arms are speculatable
+  enum class Strategy {
+    Auto,   // a select when both arms together are cheap, else branches
+    Select, // always a select
+    Branch, // always branches
+  };
+  static inline thread_local Strategy strategy = Strategy::Auto;
+  // Auto evaluates both arms unconditionally up to this cost, where a
+  // mispredicted branch would cost more
+  static constexpr unsigned selectBudget = 8;
+
+  // Streaming emission, called around the arms as they are parsed:
+  // emitCond() branches on the condition and enters `then`, emitElse() closes
+  // `then` and enters `else`, emitMerge() joins both arms with a PHI.
+  static llvm::BranchInst *emitCond(llvm::Value *cond);
+  static llvm::BranchInst *emitElse(llvm::BranchInst *condBr);
+  static llvm::Value *emitMerge(llvm::BranchInst *thenBr, llvm::Value *tv,
+                                llvm::Value *ev);
+
+private:
+  bool selectable() const;
+  llvm::Value *emitSelect();
+};
+
+// A `;` separated sequence, valued by its last expression. Bindings
+// declared inside go out of scope at its end.
+class BlockExprAST : public ExprAST {
+  std::vector<std::unique_ptr<ExprAST>> exprs;
+
+public:
+  explicit BlockExprAST(std::vector<std::unique_ptr<ExprAST>> &exprs)
+      : exprs(std::move(exprs)) {}
+  std::string to_string() const override;
+  llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  void children(const std::function<void(ExprAST &)> &fn) override;
+  bool speculatable() const override;
+  unsigned cost() const override;
+  void setTail(bool tail) override;
+};
+
+class VarExprAST : public ExprAST {
+  Parameter var;
+  std::unique_ptr<ExprAST> init;
+
+public:
+  VarExprAST(Parameter var, ExprAST *init) : var(std::move(var)), init(init) {}
+  std::string to_string() const override;
+  llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  void children(const std::function<void(ExprAST &)> &fn) override;
+  bool speculatable() const override { return init->speculatable(); }
+  unsigned cost() const override { return init->cost(); }
+  const std::string &getName() const { return var.name; }
+};
+
+class AssignExprAST : public ExprAST {
+  std::string name;
+  std::unique_ptr<ExprAST> value;
+
+public:
+  AssignExprAST(const std::string &name, ExprAST *value)
+      : name(name), value(value) {}
+  std::string to_string() const override;
+  llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  void children(const std::function<void(ExprAST &)> &fn) override;
+  const std::string &getName() const { return name; }
+};
+
+class WhileExprAST : public ExprAST {
+  std::unique_ptr<ExprAST> condition;
+  std::unique_ptr<ExprAST> body;
+
+public:
+  WhileExprAST(ExprAST *condition, ExprAST *body)
+      : condition(condition), body(body) {}
+  std::string to_string() const override;
+  llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  void children(const std::function<void(ExprAST &)> &fn) override;
+};
+
+// for i = start, condition[, step] { body }
+class ForExprAST : public ExprAST {
+  Parameter var;
+  std::unique_ptr<ExprAST> start;
+  std::unique_ptr<ExprAST> condition;
+  std::unique_ptr<ExprAST> step; // nullptr steps by 1
+  std::unique_ptr<ExprAST> body;
+
+public:
+  ForExprAST(const std::string &name, ExprAST *start, ExprAST *condition,
+             ExprAST *step, ExprAST *body)
+      : var{name}, start(start), condition(condition), step(step),
+        body(body) {}
+  std::string to_string() const override;
+  llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  void children(const std::function<void(ExprAST &)> &fn) override;
+  const std::string &getVarName() const { return var.name; }
+
+private:
+  // drop bounds checks of `a[i]` in the body when the loop provably keeps
+  // 0 <= i < len(a)
+  void markInBounds();
+};
+
+// a[index], or a[index] = value when value is set
+class IndexExprAST : public ExprAST {
+  std::string name;
+  std::unique_ptr<ExprAST> index;
+  std::unique_ptr<ExprAST> value;
+  bool inBounds = false;
+
+public:
+  IndexExprAST(const std::string &name, ExprAST *index,
+               ExprAST *value = nullptr)
+      : name(name), index(index), value(value) {}
+  std::string to_string() const override;
+  llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  void children(const std::function<void(ExprAST &)> &fn) override;
+  const std::string &getName() const { return name; }
+  ExprAST &getIndex() const { return *index; }
+  bool isStore() const { return value != nullptr; }
+  void setInBounds() { inBounds = true; }
+};
+
+// par(a op b) or par(f(x, y)): the calls among the operands run as tasks
+// on the runtime's work-stealing pool, once their arguments are evaluated
+// in order. Operands must not write what the others access.
+class ParExprAST : public ExprAST {
+  std::unique_ptr<ExprAST> expr;
+
+public:
+  explicit ParExprAST(ExprAST *expr) : expr(expr) {}
+  std::string to_string() const override;
+  llvm::Value *codegen() override;
+  Type inferType(TypeContext &ctx) override;
+  void hash(StructuralHash &h) const override;
+  std::unique_ptr<ExprAST> clone() const override;
+  void serialize(ASTWriter &w) const override;
+  void children(const std::function<void(ExprAST &)> &fn) override;
+
+  // Tasks are only forked while fewer than this many wait in the pool,
+  // below that the calls run in order. 0 is twice the hardware threads.
+  static inline thread_local unsigned cutoff = 0;
+};
+
+// All top-level items of a parsed program, in source order.
+class ModuleAST {
+  std::vector<std::unique_ptr<PrototypeAST>> externs;
+  std::vector<std::unique_ptr<FunctionAST>> functions;
+  std::unordered_map<std::string, PrototypeAST *> prototypes;
+
+public:
+  void addExtern(PrototypeAST *proto);
+  void addFunction(FunctionAST *func);
+  // add the items of a module parsed from the source that follows
+  void append(ModuleAST &&other);
+  PrototypeAST *getPrototype(const std::string &name) const;
+  std::string to_string() const;
+  void hash(StructuralHash &h) const;
+  void serialize(ASTWriter &w) const;
+  // names of the defined functions, in definition order
+  std::vector<std::string> getFunctionNames() const;
+
+  // infer parameter and return types of every function from literals and
+  // call sites, iterating to a fixed point. False if an array is used as a
+  // number.
+  bool inferTypes();
+  // Whole-program mode, before codegen: drop the functions and externs the
+  // exported functions cannot reach, and make the rest internal. False if
+  // an export is not defined.
+  bool internalize(const std::vector<std::string> &exports);
+  // Interprocedural: what each function may do, from the expressions it
+  // evaluates and the functions it calls.
+  void inferEffects();
+  // Pick the functions to memoize: those marked @memo, which must be pure
+  // with scalar parameters, and with autoMemo pure functions calling
+  // themselves more than once. False if a @memo function cannot be.
+  bool chooseMemoized();
+  // what a memoized function does besides its body: the table handle is
+  // read, the runtime's entries read and written
+  static llvm::MemoryEffects memoEffects();
+  static inline thread_local bool autoMemo = false;
+  // After type inference: clone callees per distinct pattern of literal
+  // arguments, binding the literals in the clone, and point the calls at
+  // the clones. The clones may add this percentage of the program's size.
+  void specialize();
+  static inline thread_local unsigned specializeGrowth = 0;
+  // emit line tables, see DebugInfo.hpp
+  static inline thread_local bool debugInfo = false;
+  bool codegen();
+  // emit the batch kernel of a function defined in this module
+  llvm::Function *codegenBatch(const std::string &name);
 };
 } // namespace Toy
 
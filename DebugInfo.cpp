@@ -0,0 +1,63 @@
+#include "DebugInfo.hpp"
+#include "AST.hpp"
+
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/Support/Path.h>
+
+namespace Toy {
+namespace {
+// the module and function being compiled, on this thread
+thread_local std::unique_ptr<llvm::DIBuilder> builder;
+thread_local llvm::DICompileUnit *unit = nullptr;
+thread_local llvm::DISubprogram *subprogram = nullptr;
+} // namespace
+
+void beginDebugInfo(llvm::Module &module) {
+  builder = std::make_unique<llvm::DIBuilder>(module);
+  auto &source = module.getSourceFileName();
+  auto file = builder->createFile(llvm::sys::path::filename(source),
+                                  llvm::sys::path::parent_path(source));
+  unit = builder->createCompileUnit(llvm::dwarf::DW_LANG_C, file, "toy",
+                                    false, "", 0);
+  module.addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                       llvm::DEBUG_METADATA_VERSION);
+  module.addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+}
+void finishDebugInfo() {
+  if (builder) {
+    builder->finalize();
+  }
+  resetDebugInfo();
+}
+void resetDebugInfo() {
+  builder.reset();
+  unit = nullptr;
+  subprogram = nullptr;
+}
+
+void debugFunction(llvm::Function *func, unsigned line) {
+  if (!builder) {
+    return;
+  }
+  // perf and debuggers only need the lines, parameters stay untyped
+  auto type = builder->createSubroutineType(builder->getOrCreateTypeArray({}));
+  subprogram = builder->createFunction(
+      unit, func->getName(), func->getName(), unit->getFile(), line, type,
+      line, llvm::DINode::FlagPrototyped,
+      llvm::DISubprogram::SPFlagDefinition);
+  func->setSubprogram(subprogram);
+  // calls need a location in a function with debug info, even on line 0
+  Builder->SetCurrentDebugLocation(
+      llvm::DILocation::get(*TheContext, line, 0, subprogram));
+}
+void endDebugFunction() {
+  subprogram = nullptr;
+  Builder->SetCurrentDebugLocation(llvm::DebugLoc());
+}
+void debugLine(unsigned line) {
+  if (subprogram && line) {
+    Builder->SetCurrentDebugLocation(
+        llvm::DILocation::get(*TheContext, line, 0, subprogram));
+  }
+}
+} // namespace Toy
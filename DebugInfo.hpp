@@ -0,0 +1,24 @@
+#ifndef DEBUG_INFO_HPP
+#define DEBUG_INFO_HPP
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+
+namespace Toy {
+// Line tables for -g, from the lines the parser records on function
+// definitions, statements and calls. Functions compiled between
+// beginDebugInfo and finishDebugInfo get a subprogram in the module's
+// source file, the others none.
+void beginDebugInfo(llvm::Module &module);
+void finishDebugInfo();
+// drop the state of an unfinished module, on LLVMInit
+void resetDebugInfo();
+// Called at the start of a function body defined at line. Sets the
+// builder's location until endDebugFunction.
+void debugFunction(llvm::Function *func, unsigned line);
+void endDebugFunction();
+// code emitted from now on is at line of the current function, 0 keeps the
+// previous line
+void debugLine(unsigned line);
+} // namespace Toy
+
+#endif // DEBUG_INFO_HPP
@@ -0,0 +1,105 @@
+#include "AST.hpp"
+
+#include <unordered_set>
+
+namespace Toy {
+namespace {
+// what a function body does by itself, and whom it calls
+struct Summary {
+  Effects local{llvm::MemoryEffects::none(), true, true};
+  std::vector<std::string> callees;
+};
+
+Summary summarize(FunctionAST &func) {
+  Summary summary;
+  if (func.getProto().isMemoized()) {
+    summary.local.memory |= ModuleAST::memoEffects();
+  }
+  func.walk([&](ExprAST &e) {
+    if (auto call = dynamic_cast<CallExprAST *>(&e)) {
+      summary.callees.push_back(call->getCallee());
+    } else if (auto index = dynamic_cast<IndexExprAST *>(&e)) {
+      // arrays are only ever parameters, and the bounds check may trap
+      auto access =
+          index->isStore() ? llvm::ModRefInfo::ModRef : llvm::ModRefInfo::Ref;
+      summary.local.memory |=
+          llvm::MemoryEffects::argMemOnly(access) |
+          llvm::MemoryEffects::inaccessibleMemOnly(llvm::ModRefInfo::Mod);
+      summary.local.willreturn = false;
+    } else if (auto binary = dynamic_cast<BinaryExprAST *>(&e);
+               binary && binary->mayTrap()) {
+      // integer division checks its operands and may trap
+      summary.local.memory |=
+          llvm::MemoryEffects::inaccessibleMemOnly(llvm::ModRefInfo::Mod);
+      summary.local.willreturn = false;
+    } else if (dynamic_cast<ParExprAST *>(&e)) {
+      // the pool's queue length is read, and the pool's state written
+      summary.local.memory |=
+          llvm::MemoryEffects(llvm::IRMemLocation::Other,
+                              llvm::ModRefInfo::Ref) |
+          llvm::MemoryEffects::inaccessibleMemOnly();
+    } else if (dynamic_cast<WhileExprAST *>(&e) ||
+               dynamic_cast<ForExprAST *>(&e)) {
+      // termination is not provable
+      summary.local.willreturn = false;
+    }
+  });
+  return summary;
+}
+} // namespace
+
+void ModuleAST::inferEffects() {
+  std::unordered_map<std::string, Summary> summaries;
+  for (auto &i : functions) {
+    if (!i->getProto().hasDeclaredEffects()) {
+      summaries[i->getProto().getName()] = summarize(*i);
+    }
+  }
+  // neither is termination of anything in a call cycle
+  for (auto &[name, summary] : summaries) {
+    std::unordered_set<std::string> seen;
+    auto work = summary.callees;
+    while (!work.empty()) {
+      auto callee = std::move(work.back());
+      work.pop_back();
+      if (callee == name) {
+        summary.local.willreturn = false;
+        break;
+      }
+      auto it = summaries.find(callee);
+      if (it != summaries.end() && seen.insert(callee).second) {
+        work.insert(work.end(), it->second.callees.begin(),
+                    it->second.callees.end());
+      }
+    }
+  }
+
+  // callees' effects are the caller's too, iterate to a fixed point
+  for (auto &[name, summary] : summaries) {
+    getPrototype(name)->setEffects(summary.local);
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto &[name, summary] : summaries) {
+      auto proto = getPrototype(name);
+      auto effects = summary.local;
+      for (auto &callee : summary.callees) {
+        if (auto p = getPrototype(callee)) {
+          effects |= p->getEffects();
+        } else if (callee == "print") {
+          // the runtime's buffer only
+          effects |= Effects{llvm::MemoryEffects::inaccessibleMemOnly(), true,
+                             true};
+        } else if (callee != "len" && !mathArity(callee)) {
+          effects |= Effects();
+        }
+      }
+      if (effects != proto->getEffects()) {
+        proto->setEffects(effects);
+        changed = true;
+      }
+    }
+  }
+}
+} // namespace Toy
@@ -0,0 +1,81 @@
+#include "Emit.hpp"
+#include "Logger.hpp"
+
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace Toy {
+bool emitModule(llvm::Module &module, FileType type, const std::string &path,
+                llvm::TargetMachine *tm) {
+  if (type == FileType::None) {
+    return true;
+  }
+  bool text = type == FileType::IR || type == FileType::Assembly;
+  std::error_code ec;
+  llvm::raw_fd_ostream out(path, ec,
+                           text ? llvm::sys::fs::OF_Text
+                                : llvm::sys::fs::OF_None);
+  if (ec) {
+    LOG_ERROR("cannot write {}: {}", path, ec.message());
+    return false;
+  }
+  if (!emitModule(module, type, out, tm)) {
+    return false;
+  }
+  out.flush();
+  if (out.has_error()) {
+    LOG_ERROR("cannot write {}: {}", path, out.error().message());
+    out.clear_error();
+    return false;
+  }
+  return true;
+}
+
+bool emitModule(llvm::Module &module, FileType type,
+                llvm::raw_pwrite_stream &out, llvm::TargetMachine *tm) {
+  switch (type) {
+  case FileType::None:
+    break;
+  case FileType::Bitcode:
+    llvm::WriteBitcodeToFile(module, out);
+    break;
+  case FileType::IR:
+    module.print(out, nullptr);
+    break;
+  default: {
+    if (!tm) {
+      LOG_ERROR("no target machine for the host");
+      return false;
+    }
+    llvm::legacy::PassManager pm;
+    auto fileType = type == FileType::Assembly
+                        ? llvm::CodeGenFileType::AssemblyFile
+                        : llvm::CodeGenFileType::ObjectFile;
+    if (tm->addPassesToEmitFile(pm, out, nullptr, fileType)) {
+      LOG_ERROR("the target cannot emit this file type");
+      return false;
+    }
+    pm.run(module);
+    break;
+  }
+  }
+  return true;
+}
+
+std::unique_ptr<llvm::Module> readModule(const std::string &path,
+                                         llvm::LLVMContext &context) {
+  llvm::SMDiagnostic err;
+  auto module = llvm::parseIRFile(path, err, context);
+  if (!module) {
+    std::string message;
+    llvm::raw_string_ostream os(message);
+    err.print(path.c_str(), os);
+    LOG_ERROR("{}", os.str());
+  }
+  return module;
+}
+} // namespace Toy
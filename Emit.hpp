@@ -0,0 +1,27 @@
+#ifndef EMIT_HPP
+#define EMIT_HPP
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace Toy {
+enum class FileType { None, Bitcode, IR, Assembly, Object };
+// --emit spellings, by FileType
+inline constexpr std::string_view fileTypeNames[] = {"none", "bc", "ll",
+                                                     "asm", "obj"};
+
+// Write module to path, "-" for stdout. Assembly and objects are generated
+// by tm, which must be the one the module was optimized for.
+bool emitModule(llvm::Module &module, FileType type, const std::string &path,
+                llvm::TargetMachine *tm);
+bool emitModule(llvm::Module &module, FileType type,
+                llvm::raw_pwrite_stream &out, llvm::TargetMachine *tm);
+// A module written as bitcode or textual IR, to compile it again without
+// the front end. nullptr on errors, which are logged.
+std::unique_ptr<llvm::Module> readModule(const std::string &path,
+                                         llvm::LLVMContext &context);
+} // namespace Toy
+
+#endif // EMIT_HPP
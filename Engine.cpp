@@ -0,0 +1,396 @@
+#include "Engine.hpp"
+#include "AST.hpp"
+#include "Optimizer.hpp"
+#include "Parse.hpp"
+#include "Profile.hpp"
+#include "Report.hpp"
+#include "Runtime.hpp"
+
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ObjectTransformLayer.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Object/SymbolSize.h>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+
+namespace Toy {
+static std::string signatureOf(llvm::Function &func) {
+  auto code = [](llvm::Type *type) {
+    if (type->isDoubleTy()) {
+      return 'd';
+    }
+    if (type->isIntegerTy(64)) {
+      return 'i';
+    }
+    if (type->isPointerTy()) {
+      return 'p';
+    }
+    return type->isVoidTy() ? 'v' : '?';
+  };
+  std::string signature(1, code(func.getReturnType()));
+  for (auto &i : func.args()) {
+    signature += code(i.getType());
+  }
+  return signature;
+}
+
+// Tells where compiled functions are: to perf by appending "address size
+// name" lines to /tmp/perf-<pid>.map, where it looks up code that has no
+// ELF file, and to the sampling profiler.
+class CodeListener : public llvm::JITEventListener {
+public:
+  CodeListener(bool perfMap, bool sampling)
+      : perfMap(perfMap), sampling(sampling) {}
+  void notifyObjectLoaded(
+      ObjectKey key, const llvm::object::ObjectFile &obj,
+      const llvm::RuntimeDyld::LoadedObjectInfo &info) override {
+    // symbols at their load addresses
+    auto loaded = info.getObjectForDebug(obj);
+    if (!loaded.getBinary()) {
+      return;
+    }
+    std::string lines;
+    for (auto &[symbol, size] :
+         llvm::object::computeSymbolSizes(*loaded.getBinary())) {
+      auto type = symbol.getType();
+      auto name = symbol.getName();
+      auto address = symbol.getAddress();
+      if (!type || !name || !address ||
+          *type != llvm::object::SymbolRef::ST_Function || !size) {
+        llvm::consumeError(type.takeError());
+        llvm::consumeError(name.takeError());
+        llvm::consumeError(address.takeError());
+        continue;
+      }
+      lines += std::format("{:x} {:x} {}\n", *address, size, name->str());
+      if (sampling) {
+        reportCode(*address, size, name->str());
+      }
+    }
+    if (!perfMap) {
+      return;
+    }
+    std::lock_guard lock(mutex);
+    if (!file) {
+      auto path = std::format("/tmp/perf-{}.map", ::getpid());
+      if (!(file = std::fopen(path.c_str(), "a"))) {
+        LOG_WARN("cannot write {}", path);
+        return;
+      }
+    }
+    std::fwrite(lines.data(), 1, lines.size(), file);
+    std::fflush(file);
+  }
+  ~CodeListener() override {
+    if (file) {
+      std::fclose(file);
+    }
+  }
+
+private:
+  bool perfMap;
+  bool sampling;
+  std::mutex mutex;
+  std::FILE *file = nullptr;
+};
+
+namespace detail {
+struct Code {
+  llvm::orc::JITDylib &dylib;
+  // by the names the code was compiled with
+  std::unordered_map<std::string, Symbol> symbols;
+
+  ~Code() {
+    if (auto err = dylib.getExecutionSession().removeJITDylib(dylib)) {
+      LOG_ERROR("{}", llvm::toString(std::move(err)));
+    }
+  }
+};
+} // namespace detail
+
+Program::~Program() = default;
+void *Program::lookup(std::string_view name, std::string_view signature) const {
+  auto it = symbols.find(std::string(name));
+  if (it == symbols.end()) {
+    LOG_ERROR("Unknown function referenced");
+    return nullptr;
+  }
+  if (it->second.signature != signature) {
+    LOG_ERROR("{} has signature {}, looked up as {}", std::string(name),
+              it->second.signature, std::string(signature));
+    return nullptr;
+  }
+  return it->second.address;
+}
+std::string_view Program::signature(std::string_view name) const {
+  auto it = symbols.find(std::string(name));
+  return it == symbols.end() ? std::string_view() : it->second.signature;
+}
+
+Engine::Engine(bool profiling) {
+  initializeNativeTarget();
+  tm = createTargetMachine();
+  llvm::orc::LLJITBuilder builder;
+  bool sampling = getReportMode() == ReportMode::Sample;
+  if (profiling || sampling) {
+    codeListener = std::make_unique<CodeListener>(profiling, sampling);
+    if (profiling &&
+        !(perfDump = llvm::JITEventListener::createPerfJITEventListener())) {
+      LOG_WARN("LLVM is built without perf support, writing no jitdump");
+    }
+    // the listeners need the RuntimeDyld linker
+    builder.setObjectLinkingLayerCreator(
+        [this](llvm::orc::ExecutionSession &es, const llvm::Triple &)
+            -> llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>> {
+          auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+              es, [](const llvm::MemoryBuffer &) {
+                return std::make_unique<llvm::SectionMemoryManager>();
+              });
+          layer->registerJITEventListener(*codeListener);
+          if (perfDump) {
+            layer->registerJITEventListener(*perfDump);
+          }
+          return std::move(layer);
+        });
+  }
+  auto jit = builder.create();
+  if (!jit) {
+    LOG_FATAL("{}", llvm::toString(jit.takeError()));
+    return;
+  }
+  this->jit = std::move(*jit);
+  host = &this->jit->getExecutionSession().createBareJITDylib("host");
+  auto process =
+      llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          this->jit->getDataLayout().getGlobalPrefix());
+  if (process) {
+    host->addGenerator(std::move(*process));
+  } else {
+    LOG_WARN("{}", llvm::toString(process.takeError()));
+  }
+  define("toy_profile_init", toy_profile_init);
+  define("toy_profile_counters", toy_profile_counters);
+  define("toy_memo_table", toy_memo_table);
+  define("toy_memo_lookup", toy_memo_lookup);
+  define("toy_memo_store", toy_memo_store);
+  define("toy_print_double", toy_print_double);
+  define("toy_print_int", toy_print_int);
+  define("toy_par_run", toy_par_run);
+  define("toy_par_queued", &toy_par_queued);
+  define("toy_report_init", toy_report_init);
+  define("toy_report_function", toy_report_function);
+  define("toy_report_enter", toy_report_enter);
+  define("toy_report_exit", toy_report_exit);
+  this->jit->getObjTransformLayer().setTransform(
+      [this](std::unique_ptr<llvm::MemoryBuffer> obj)
+          -> llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> {
+        emitted += obj->getBufferSize();
+        return std::move(obj);
+      });
+}
+Engine::~Engine() = default;
+
+void Engine::define(const std::string &name, void *address) {
+  if (!jit) {
+    return;
+  }
+  llvm::orc::SymbolMap symbols;
+  symbols[jit->mangleAndIntern(name)] = llvm::orc::ExecutorSymbolDef(
+      llvm::orc::ExecutorAddr::fromPtr(address),
+      llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable);
+  if (auto err = host->define(llvm::orc::absoluteSymbols(symbols))) {
+    LOG_ERROR("{}", llvm::toString(std::move(err)));
+  }
+}
+
+void Engine::setCacheCapacity(size_t bytes) {
+  std::lock_guard lock(mutex);
+  cacheCapacity = bytes;
+  evict();
+}
+
+std::shared_ptr<Program>
+Engine::instantiate(const CacheEntry &entry,
+                    const std::vector<std::string> &names) {
+  // the i-th function of an equivalent source is the i-th compiled one
+  std::unordered_map<std::string, detail::Symbol> symbols;
+  for (size_t i = 0; i < names.size(); i++) {
+    auto &compiled = entry.code->symbols;
+    for (auto suffix : {"", "_batch"}) {
+      auto it = compiled.find(entry.names[i] + suffix);
+      if (it != compiled.end()) {
+        symbols[names[i] + suffix] = it->second;
+      }
+    }
+  }
+  return std::shared_ptr<Program>(new Program(entry.code, std::move(symbols)));
+}
+void Engine::touch(CacheIterator entry) {
+  lru.splice(lru.begin(), lru, entry);
+}
+void Engine::evict() {
+  while (cacheSize > cacheCapacity && !lru.empty()) {
+    auto &entry = lru.back();
+    for (auto &i : entry.sources) {
+      sources.erase(i);
+    }
+    cache.erase(entry.key);
+    cacheSize -= entry.size;
+    // the dylib goes with the last Program still holding the code
+    lru.pop_back();
+  }
+}
+
+std::shared_ptr<Program> Engine::compile(std::string_view source,
+                                         const std::vector<std::string> &batch) {
+  if (!jit) {
+    return nullptr;
+  }
+  std::lock_guard lock(mutex);
+  auto profile = profileKey() + ";" + reportKey();
+  auto strategy = static_cast<int>(IfElseExprAST::strategy);
+  auto fpModel = static_cast<int>(PrototypeAST::fpModel);
+  auto vectorLibrary = static_cast<int>(getVectorLibrary());
+  auto sourceKey = std::format(
+      "O{};{};{};{};{};{};{};{};{}", optLevel, strategy, fpModel,
+      vectorLibrary, ParExprAST::cutoff, ModuleAST::autoMemo,
+      ModuleAST::specializeGrowth, ModuleAST::debugInfo, profile);
+  for (auto &i : batch) {
+    sourceKey += std::format(",{}", i);
+  }
+  for (auto &i : exports) {
+    sourceKey += std::format(";{}", i);
+  }
+  sourceKey += '\n';
+  sourceKey += source;
+  if (auto it = sources.find(sourceKey); it != sources.end()) {
+    touch(it->second.entry);
+    return instantiate(*it->second.entry, it->second.names);
+  }
+
+  ModuleAST module;
+  if (isSerializedAST(source) ? !deserializeAST(source, module)
+                              : !parseProgram(source, module)) {
+    return nullptr;
+  }
+  if (!exports.empty()) {
+    auto roots = exports;
+    roots.insert(roots.end(), batch.begin(), batch.end());
+    if (!module.internalize(roots)) {
+      return nullptr;
+    }
+  }
+  auto names = module.getFunctionNames();
+  StructuralHash hash;
+  module.hash(hash);
+  hash.add('O');
+  hash.add(static_cast<int64_t>(optLevel));
+  hash.add(static_cast<int64_t>(strategy));
+  hash.add(static_cast<int64_t>(fpModel));
+  hash.add(static_cast<int64_t>(vectorLibrary));
+  hash.add(static_cast<int64_t>(ParExprAST::cutoff));
+  hash.add(static_cast<int64_t>(ModuleAST::autoMemo));
+  hash.add(static_cast<int64_t>(ModuleAST::specializeGrowth));
+  hash.add(static_cast<int64_t>(ModuleAST::debugInfo));
+  hash.add(profile);
+  // Lines and names end up in the code with debug info, in the profilers'
+  // listings and in the profile data, so only the same source may share
+  // code then.
+  if (ModuleAST::debugInfo || codeListener || profileByName() ||
+      getReportMode() != ReportMode::Off) {
+    hash.add('S');
+    hash.add(std::string(source));
+  }
+  for (auto &i : batch) {
+    auto it = std::find(names.begin(), names.end(), i);
+    if (it == names.end()) {
+      LOG_ERROR("Unknown function referenced");
+      return nullptr;
+    }
+    hash.add('K');
+    hash.add(static_cast<int64_t>(it - names.begin()));
+  }
+  auto remember = [&](CacheIterator entry) {
+    if (cacheCapacity == 0) {
+      return;
+    }
+    entry->size += sourceKey.size();
+    cacheSize += sourceKey.size();
+    entry->sources.push_back(sourceKey);
+    sources[std::move(sourceKey)] = {entry, names};
+  };
+  if (auto it = cache.find(hash.getKey()); it != cache.end()) {
+    auto entry = it->second;
+    touch(entry);
+    auto program = instantiate(*entry, names);
+    remember(entry);
+    evict();
+    return program;
+  }
+
+  LLVMInit("toy");
+  TheModule->setDataLayout(jit->getDataLayout());
+  TheModule->setTargetTriple(jit->getTargetTriple().str());
+  if (!module.codegen()) {
+    return nullptr;
+  }
+  for (auto &i : batch) {
+    if (!module.codegenBatch(i)) {
+      return nullptr;
+    }
+  }
+  finishProfile(*TheModule);
+  finishReport(*TheModule);
+  optimizeModule(*TheModule, tm.get(), optLevel);
+
+  std::unordered_map<std::string, detail::Symbol> symbols;
+  for (auto &i : TheModule->functions()) {
+    if (!i.isDeclaration() && !i.hasLocalLinkage()) {
+      symbols[i.getName().str()] = {nullptr, signatureOf(i)};
+    }
+  }
+
+  auto &es = jit->getExecutionSession();
+  auto &dylib =
+      es.createBareJITDylib(std::format("program{}", programs++));
+  dylib.addToLinkOrder(*host);
+  Builder.reset();
+  llvm::orc::ThreadSafeModule tsm(std::move(TheModule), std::move(TheContext));
+  if (auto err = jit->addIRModule(dylib, std::move(tsm))) {
+    LOG_ERROR("{}", llvm::toString(std::move(err)));
+    llvm::consumeError(es.removeJITDylib(dylib));
+    return nullptr;
+  }
+  // materialize everything now, so that later lookups never block
+  auto code = std::make_shared<detail::Code>(dylib);
+  emitted = 0;
+  for (auto &[name, symbol] : symbols) {
+    auto addr = jit->lookup(dylib, name);
+    if (!addr) {
+      LOG_ERROR("{}", llvm::toString(addr.takeError()));
+      return nullptr;
+    }
+    symbol.address = addr->toPtr<void *>();
+  }
+  // constructors, registering profile counters
+  if (auto err = jit->initialize(dylib)) {
+    LOG_ERROR("{}", llvm::toString(std::move(err)));
+    return nullptr;
+  }
+  code->symbols = std::move(symbols);
+
+  auto key = hash.getKey();
+  auto size = emitted + key.size();
+  lru.push_front({std::move(key), code, names, {}, size});
+  auto program = instantiate(lru.front(), names);
+  cache[lru.front().key] = lru.begin();
+  cacheSize += size;
+  remember(lru.begin());
+  evict();
+  return program;
+}
+} // namespace Toy
@@ -0,0 +1,167 @@
+#ifndef ENGINE_HPP
+#define ENGINE_HPP
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace llvm {
+class JITEventListener;
+class TargetMachine;
+namespace orc {
+class LLJIT;
+class JITDylib;
+} // namespace orc
+} // namespace llvm
+
+namespace Toy {
+namespace detail {
+// one character per native type, matching the signature of JIT'd functions:
+// 'd' double, 'i' 64-bit integer, 'p' pointer (array data, batch columns)
+template <typename T> constexpr char typeCode() {
+  if constexpr (std::is_same_v<T, double>) {
+    return 'd';
+  } else if constexpr (std::is_integral_v<T> && sizeof(T) == 8) {
+    return 'i';
+  } else if constexpr (std::is_pointer_v<T>) {
+    return 'p';
+  } else if constexpr (std::is_void_v<T>) {
+    return 'v';
+  } else {
+    return '?';
+  }
+}
+
+template <typename Sig> struct Signature;
+template <typename Ret, typename... Args> struct Signature<Ret(Args...)> {
+  static std::string code() { return {typeCode<Ret>(), typeCode<Args>()...}; }
+};
+
+struct Symbol {
+  void *address;
+  std::string signature;
+};
+// JIT'd code shared by every Program compiled from equivalent sources
+struct Code;
+} // namespace detail
+
+// Compiled code of one source, resolved to native addresses. Lookups and
+// calls through the returned pointers are safe from any thread. A Program
+// must not outlive the Engine that compiled it.
+class Program {
+public:
+  ~Program();
+  Program(const Program &) = delete;
+  Program &operator=(const Program &) = delete;
+
+  // typed function pointer, nullptr if missing or the signature differs,
+  // e.g. lookup<double(double)>("f") or lookup<int64_t(int64_t)>("fib")
+  template <typename Sig> Sig *lookup(std::string_view name) const {
+    return reinterpret_cast<Sig *>(
+        lookup(name, detail::Signature<Sig>::code()));
+  }
+  // signature code of a function (see detail::typeCode), empty if missing
+  std::string_view signature(std::string_view name) const;
+
+private:
+  friend class Engine;
+  Program(std::shared_ptr<const detail::Code> code,
+          std::unordered_map<std::string, detail::Symbol> symbols)
+      : code(std::move(code)), symbols(std::move(symbols)) {}
+  void *lookup(std::string_view name, std::string_view signature) const;
+
+  std::shared_ptr<const detail::Code> code;
+  // by the names of this program's source
+  std::unordered_map<std::string, detail::Symbol> symbols;
+};
+
+class CodeListener;
+
+// Compiles Toy sources into native code once, for many calls.
+class Engine {
+public:
+  // With profiling, compiled functions are listed in /tmp/perf-<pid>.map
+  // and, if LLVM has perf support, in a jitdump file for `perf inject
+  // --jit`, which also carries source lines of code compiled with
+  // ModuleAST::debugInfo. With ReportMode::Sample set beforehand, the
+  // code of compiled functions is passed to reportCode.
+  explicit Engine(bool profiling = false);
+  ~Engine();
+
+  // Satisfy `extern` prototypes of programs compiled afterwards. Symbols
+  // of the host process are also visible, host definitions take precedence.
+  void define(const std::string &name, void *address);
+  template <typename Ret, typename... Args>
+  void define(const std::string &name, Ret (*fn)(Args...)) {
+    define(name, reinterpret_cast<void *>(fn));
+  }
+
+  void setOptLevel(unsigned level) { optLevel = level; }
+  // Whole-program mode: programs only export these functions (and their
+  // batch kernels), everything else is internal or dropped. Empty exports
+  // every function.
+  void setExports(std::vector<std::string> names) {
+    exports = std::move(names);
+  }
+  // Bound on the machine code kept alive for cache hits, in bytes. Least
+  // recently used code is dropped first, and its dylib is freed once no
+  // Program refers to it. 0 disables caching.
+  void setCacheCapacity(size_t bytes);
+
+  // Programs that only differ in the names they pick share their machine
+  // code: a repeated source costs a lookup, an alpha-equivalent one a
+  // parse and a hash. The source may also be serializeAST() output.
+  // nullptr on parse or codegen errors, which are logged.
+  std::shared_ptr<Program> compile(std::string_view source,
+                                   const std::vector<std::string> &batch = {});
+
+private:
+  struct CacheEntry {
+    std::string key;
+    std::shared_ptr<const detail::Code> code;
+    // function names the code was compiled with, in definition order
+    std::vector<std::string> names;
+    // exact sources known to produce this entry
+    std::vector<std::string> sources;
+    size_t size;
+  };
+  using CacheIterator = std::list<CacheEntry>::iterator;
+  struct Source {
+    CacheIterator entry;
+    std::vector<std::string> names;
+  };
+
+  std::shared_ptr<Program> instantiate(const CacheEntry &entry,
+                                       const std::vector<std::string> &names);
+  void touch(CacheIterator entry);
+  void evict();
+
+  // before the JIT, whose linking layer refers to them
+  std::unique_ptr<CodeListener> codeListener;
+  llvm::JITEventListener *perfDump = nullptr;
+  std::unique_ptr<llvm::orc::LLJIT> jit;
+  std::unique_ptr<llvm::TargetMachine> tm;
+  llvm::orc::JITDylib *host = nullptr;
+  // codegen goes through the global IRBuilder and module
+  std::mutex mutex;
+  unsigned optLevel = 2;
+  std::vector<std::string> exports;
+  unsigned programs = 0;
+  // object bytes emitted by the JIT, to size cache entries
+  std::atomic<size_t> emitted = 0;
+
+  // most recently used first
+  std::list<CacheEntry> lru;
+  std::unordered_map<std::string, CacheIterator> cache;
+  std::unordered_map<std::string, Source> sources;
+  size_t cacheSize = 0;
+  size_t cacheCapacity = 64 << 20;
+};
+} // namespace Toy
+
+#endif // ENGINE_HPP
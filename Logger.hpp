@@ -45,6 +45,8 @@ public:
       : currentLevel(level), outputStream(out) {}
 
   void setLogLevel(LogLevel level) { currentLevel = level; }
+  // whether messages of level are written, to skip building costly ones
+  bool enabled(LogLevel level) const { return level >= currentLevel; }
 
   template <typename... Args>
   std::ostream &log(LogLevel level, std::format_string<Args...> fmt,
@@ -55,7 +57,8 @@ public:
 
     std::lock_guard lock(logMutex);
     writeHeader(level);
-    outputStream << std::format(fmt, args...) << std::endl;
+    outputStream << std::vformat(fmt.get(), std::make_format_args(args...))
+                 << std::endl;
     return outputStream;
   }
 
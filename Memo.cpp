@@ -0,0 +1,153 @@
+#include "AST.hpp"
+
+#include <llvm/IR/Verifier.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+#include <cassert>
+
+namespace Toy {
+namespace {
+// the table's entries are the runtime's, keys and results pass in memory
+llvm::FunctionCallee hook(const char *name, llvm::Type *result,
+                          llvm::ArrayRef<llvm::Type *> args) {
+  auto type = llvm::FunctionType::get(result, args, false);
+  auto func = llvm::cast<llvm::Function>(
+      TheModule->getOrInsertFunction(name, type).getCallee());
+  func->setMemoryEffects(llvm::MemoryEffects::inaccessibleOrArgMemOnly());
+  func->setDoesNotThrow();
+  func->setWillReturn();
+  return func;
+}
+} // namespace
+
+llvm::MemoryEffects ModuleAST::memoEffects() {
+  return llvm::MemoryEffects(llvm::IRMemLocation::Other,
+                             llvm::ModRefInfo::Ref) |
+         llvm::MemoryEffects::inaccessibleMemOnly();
+}
+bool ModuleAST::chooseMemoized() {
+  bool any = false;
+  for (auto &i : functions) {
+    auto &proto = i->getProto();
+    auto &args = proto.getArguments();
+    bool scalar = std::none_of(args.begin(), args.end(), [](auto &arg) {
+      return arg.type == Type::Array;
+    });
+    auto &effects = proto.getEffects();
+    bool pure = effects.memory.doesNotAccessMemory() && effects.nounwind;
+    if (proto.hasAttribute("memo")) {
+      if (!scalar || !pure) {
+        LOG_ERROR("@memo {} must be pure and take scalars", proto.getName());
+        return false;
+      }
+      proto.setMemoized();
+      any = true;
+      continue;
+    }
+    if (!autoMemo || !scalar || !pure || args.empty()) {
+      continue;
+    }
+    // tree recursion, like fib, recomputes exponentially many calls
+    unsigned self = 0;
+    i->walk([&](ExprAST &e) {
+      auto call = dynamic_cast<CallExprAST *>(&e);
+      self += call && call->getCallee() == proto.getName();
+    });
+    if (self > 1) {
+      proto.setMemoized();
+      any = true;
+    }
+  }
+  if (any) {
+    // callers, and the body through its recursive calls, see the table
+    for (auto &i : functions) {
+      auto &proto = i->getProto();
+      if (proto.isMemoized() && proto.hasDeclaredEffects()) {
+        auto effects = proto.getEffects();
+        effects.memory |= memoEffects();
+        proto.setEffects(effects);
+      }
+    }
+    inferEffects();
+  }
+  return true;
+}
+
+llvm::Function *FunctionAST::memoize(llvm::Function *impl) {
+  auto name = impl->getName().str();
+  auto wrapper = llvm::Function::Create(impl->getFunctionType(),
+                                        impl->getLinkage(), "",
+                                        TheModule.get());
+  // recursive calls and callers compiled so far go through the table
+  impl->replaceAllUsesWith(wrapper);
+  wrapper->takeName(impl);
+  wrapper->copyAttributesFrom(impl);
+  impl->setName(name + ".impl");
+  impl->setLinkage(llvm::Function::InternalLinkage);
+
+  auto ptrTy = llvm::PointerType::getUnqual(*TheContext);
+  auto i64 = llvm::Type::getInt64Ty(*TheContext);
+  auto i32 = llvm::Type::getInt32Ty(*TheContext);
+  auto voidTy = llvm::Type::getVoidTy(*TheContext);
+  auto arity = wrapper->arg_size();
+
+  // the table is created before any call, by a constructor
+  auto table = new llvm::GlobalVariable(
+      *TheModule, ptrTy, false, llvm::GlobalValue::InternalLinkage,
+      llvm::ConstantPointerNull::get(ptrTy), "__toy_memo." + name);
+  auto init = llvm::Function::Create(llvm::FunctionType::get(voidTy, false),
+                                     llvm::GlobalValue::InternalLinkage,
+                                     "__toy_memo.init." + name, *TheModule);
+  Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", init));
+  auto create = TheModule->getOrInsertFunction("toy_memo_table", ptrTy, ptrTy,
+                                               i64);
+  Builder->CreateStore(
+      Builder->CreateCall(create, {Builder->CreateGlobalStringPtr(name),
+                                   llvm::ConstantInt::get(i64, arity)}),
+      table);
+  Builder->CreateRetVoid();
+  llvm::appendToGlobalCtors(*TheModule, init, 0);
+
+  // keys and results are the bits of the values
+  auto entry = llvm::BasicBlock::Create(*TheContext, "entry", wrapper);
+  auto hitBB = llvm::BasicBlock::Create(*TheContext, "memo.hit", wrapper);
+  auto missBB = llvm::BasicBlock::Create(*TheContext, "memo.miss", wrapper);
+  Builder->SetInsertPoint(entry);
+  auto keysTy = llvm::ArrayType::get(i64, arity);
+  auto keys = Builder->CreateAlloca(keysTy, nullptr, "keys");
+  auto out = Builder->CreateAlloca(i64, nullptr, "out");
+  std::vector<llvm::Value *> args;
+  for (auto &i : wrapper->args()) {
+    i.setName(impl->getArg(i.getArgNo())->getName());
+    args.push_back(&i);
+    // chooseMemoized only takes scalar parameters: an array would be a ptr
+    // and its length, which have no 64-bit pattern standing for the values
+    assert(i.getType()->getPrimitiveSizeInBits() == 64 &&
+           "memoized functions take scalars");
+    Builder->CreateStore(
+        Builder->CreateBitCast(&i, i64),
+        Builder->CreateConstInBoundsGEP2_64(keysTy, keys, 0, i.getArgNo()));
+  }
+  auto lookup = hook("toy_memo_lookup", i32, {ptrTy, ptrTy, ptrTy});
+  auto handle = Builder->CreateLoad(ptrTy, table, "table");
+  auto hit = Builder->CreateCall(lookup, {handle, keys, out});
+  Builder->CreateCondBr(
+      Builder->CreateICmpNE(hit, llvm::ConstantInt::get(i32, 0)), hitBB,
+      missBB);
+
+  Builder->SetInsertPoint(hitBB);
+  auto cached = Builder->CreateLoad(i64, out);
+  Builder->CreateRet(Builder->CreateBitCast(cached, wrapper->getReturnType()));
+
+  Builder->SetInsertPoint(missBB);
+  auto result = Builder->CreateCall(impl, args);
+  result->setCallingConv(impl->getCallingConv());
+  auto store = hook("toy_memo_store", voidTy, {ptrTy, ptrTy, i64});
+  Builder->CreateCall(store,
+                      {handle, keys, Builder->CreateBitCast(result, i64)});
+  Builder->CreateRet(result);
+  // The wrapper has the effects of the body, which chooseMemoized widened
+  // by memoEffects: the table is read above and written by the hooks.
+  llvm::verifyFunction(*wrapper);
+  return wrapper;
+}
+} // namespace Toy
@@ -0,0 +1,131 @@
+#include "Optimizer.hpp"
+#include "Logger.hpp"
+
+#include <llvm/IR/InstIterator.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/TargetParser/Host.h>
+#include <llvm/Transforms/Scalar/TailRecursionElimination.h>
+#include <llvm/Transforms/Utils/Mem2Reg.h>
+
+namespace Toy {
+static llvm::TargetLibraryInfoImpl::VectorLibrary vectorLibrary =
+    llvm::TargetLibraryInfoImpl::NoLibrary;
+
+void setVectorLibrary(llvm::TargetLibraryInfoImpl::VectorLibrary library) {
+  vectorLibrary = library;
+}
+llvm::TargetLibraryInfoImpl::VectorLibrary getVectorLibrary() {
+  return vectorLibrary;
+}
+
+void initializeNativeTarget() {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+}
+std::unique_ptr<llvm::TargetMachine> createTargetMachine() {
+  auto triple = llvm::sys::getDefaultTargetTriple();
+  std::string error;
+  auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+  if (!target) {
+    LOG_ERROR("{}", error);
+    return nullptr;
+  }
+  llvm::TargetOptions options;
+  return std::unique_ptr<llvm::TargetMachine>(
+      target->createTargetMachine(triple, llvm::sys::getHostCPUName(), "",
+                                  options, llvm::Reloc::PIC_));
+}
+
+// Internal functions that are only called directly can use the fast calling
+// convention. The default pipeline does this too, but not at level 0.
+static void useFastCC(llvm::Module &module) {
+  for (auto &func : module) {
+    if (!func.hasLocalLinkage() || func.isDeclaration() ||
+        func.getCallingConv() == llvm::CallingConv::Fast) {
+      continue;
+    }
+    // musttail needs the same convention on both sides, so only self
+    // calls may be musttail
+    auto mustTailElsewhere = [&](llvm::CallInst *call) {
+      return call->isMustTailCall() &&
+             (call->getFunction() != &func ||
+              call->getCalledFunction() != &func);
+    };
+    std::vector<llvm::CallInst *> calls;
+    bool direct = true;
+    for (auto user : func.users()) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(user);
+      if (!call || call->getCalledOperand() != &func ||
+          mustTailElsewhere(call)) {
+        direct = false;
+        break;
+      }
+      calls.push_back(call);
+    }
+    for (auto &inst : llvm::instructions(func)) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      direct &= !call || !mustTailElsewhere(call);
+    }
+    if (!direct) {
+      continue;
+    }
+    func.setCallingConv(llvm::CallingConv::Fast);
+    for (auto call : calls) {
+      call->setCallingConv(llvm::CallingConv::Fast);
+    }
+  }
+}
+
+void optimizeModule(llvm::Module &module, llvm::TargetMachine *tm,
+                    unsigned level, LTOPhase phase) {
+  useFastCC(module);
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cgam;
+  llvm::ModuleAnalysisManager mam;
+  llvm::PassBuilder pb(tm);
+  // registered first, so the default one is not
+  llvm::Triple triple(module.getTargetTriple());
+  llvm::TargetLibraryInfoImpl tlii(triple);
+  tlii.addVectorizableFunctionsFromVecLib(vectorLibrary, triple);
+  fam.registerPass([&] { return llvm::TargetLibraryAnalysis(tlii); });
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cgam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+  llvm::ModulePassManager mpm;
+  switch (level) {
+  case 0: {
+    llvm::FunctionPassManager fpm;
+    fpm.addPass(llvm::PromotePass());
+    // recursion in tail position, or accumulating with + and * on integers,
+    // becomes a loop
+    fpm.addPass(llvm::TailCallElimPass());
+    mpm.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(fpm)));
+    break;
+  }
+  default: {
+    auto o = level == 1   ? llvm::OptimizationLevel::O1
+             : level == 2 ? llvm::OptimizationLevel::O2
+                          : llvm::OptimizationLevel::O3;
+    switch (phase) {
+    case LTOPhase::None:
+      mpm = pb.buildPerModuleDefaultPipeline(o);
+      break;
+    case LTOPhase::PreLink:
+      mpm = pb.buildLTOPreLinkDefaultPipeline(o);
+      break;
+    case LTOPhase::PostLink:
+      mpm = pb.buildLTODefaultPipeline(o, nullptr);
+      break;
+    }
+    break;
+  }
+  }
+  mpm.run(module, mam);
+}
+} // namespace Toy
@@ -0,0 +1,35 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+#include <memory>
+
+namespace Toy {
+// Register the host target with LLVM. Not thread-safe: call it before
+// threads create target machines.
+void initializeNativeTarget();
+// TargetMachine for the host, nullptr if the native target is unavailable
+// or not initialized
+std::unique_ptr<llvm::TargetMachine> createTargetMachine();
+
+// Vector variants of math functions (llvm.sin.f64 and friends) the loop
+// vectorizer may call, from LLVM's table for the library. The host process
+// must provide the library, e.g. link libmvec for LIBMVEC_X86.
+void setVectorLibrary(llvm::TargetLibraryInfoImpl::VectorLibrary library);
+llvm::TargetLibraryInfoImpl::VectorLibrary getVectorLibrary();
+
+// Where a module stands in link-time optimization: the parts of a program
+// get the pre-link pipeline, which leaves inlining across parts and late
+// loop transformations to the post-link one on the linked whole.
+enum class LTOPhase { None, PreLink, PostLink };
+
+// Level 0 only promotes allocas to SSA values (mem2reg) and turns tail
+// recursion into loops, levels 1-3 run the default per-module pipeline,
+// including LICM, unrolling and vectorization. Internal functions use the
+// fast calling convention at every level.
+void optimizeModule(llvm::Module &module, llvm::TargetMachine *tm,
+                    unsigned level, LTOPhase phase = LTOPhase::None);
+} // namespace Toy
+
+#endif // OPTIMIZER_HPP
@@ -0,0 +1,172 @@
+#include "AST.hpp"
+
+#include <thread>
+
+namespace Toy {
+namespace {
+// a call to run as a task, its arguments already lowered
+struct Task {
+  llvm::Function *callee;
+  std::vector<llvm::Value *> args;
+  // operand the result stands for
+  size_t operand;
+};
+
+// the callee's arguments, then its result
+llvm::StructType *frameType(llvm::Function *callee) {
+  std::vector<llvm::Type *> fields(callee->getFunctionType()->param_begin(),
+                                   callee->getFunctionType()->param_end());
+  fields.push_back(callee->getReturnType());
+  return llvm::StructType::get(*TheContext, fields);
+}
+
+// void __toy_task.<callee>(ptr frame), the entry the pool calls
+llvm::Function *thunk(llvm::Function *callee) {
+  auto name = "__toy_task." + callee->getName().str();
+  if (auto func = TheModule->getFunction(name)) {
+    return func;
+  }
+  auto ptrTy = llvm::PointerType::getUnqual(*TheContext);
+  auto func = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(*TheContext), {ptrTy},
+                              false),
+      llvm::Function::InternalLinkage, name, TheModule.get());
+  func->setDoesNotThrow();
+  auto frameTy = frameType(callee);
+  auto frame = func->getArg(0);
+  frame->setName("frame");
+  llvm::IRBuilder<> builder(
+      llvm::BasicBlock::Create(*TheContext, "entry", func));
+  std::vector<llvm::Value *> args;
+  for (auto &i : callee->args()) {
+    args.push_back(builder.CreateLoad(
+        i.getType(), builder.CreateStructGEP(frameTy, frame, i.getArgNo())));
+  }
+  auto result = builder.CreateCall(callee, args);
+  result->setCallingConv(callee->getCallingConv());
+  builder.CreateStore(result,
+                      builder.CreateStructGEP(frameTy, frame, args.size()));
+  builder.CreateRetVoid();
+  return func;
+}
+} // namespace
+
+llvm::Value *ParExprAST::codegen() {
+  auto binary = dynamic_cast<BinaryExprAST *>(expr.get());
+  auto call = dynamic_cast<CallExprAST *>(expr.get());
+  std::vector<ExprAST *> operands;
+  if (binary) {
+    operands = {&binary->getLHS(), &binary->getRHS()};
+  } else if (call) {
+    for (auto &i : call->getArguments()) {
+      operands.push_back(i.get());
+    }
+  }
+  auto combine = [&](const std::vector<llvm::Value *> &values) {
+    return binary ? BinaryExprAST::emit(binary->getOpcode(), values[0],
+                                        values[1])
+                  : CallExprAST::emit(call->getCallee(), values);
+  };
+
+  // operands in order, calls to functions stop short of the call itself
+  std::vector<llvm::Value *> values(operands.size());
+  std::vector<Task> tasks;
+  for (size_t i = 0; i < operands.size(); i++) {
+    auto c = dynamic_cast<CallExprAST *>(operands[i]);
+    auto callee = c ? TheModule->getFunction(c->getCallee()) : nullptr;
+    if (!callee) {
+      if (!(values[i] = operands[i]->codegen())) {
+        return nullptr;
+      }
+      continue;
+    }
+    std::vector<llvm::Value *> args;
+    for (auto &arg : c->getArguments()) {
+      auto v = arg->codegen();
+      if (!v) {
+        return nullptr;
+      }
+      args.push_back(v);
+    }
+    auto lowered = CallExprAST::lower(callee, args);
+    if (!lowered) {
+      return nullptr;
+    }
+    tasks.push_back({callee, std::move(*lowered), i});
+  }
+  if (tasks.empty()) {
+    return combine(values);
+  }
+
+  auto func = Builder->GetInsertBlock()->getParent();
+  auto ptrTy = llvm::PointerType::getUnqual(*TheContext);
+  auto i64 = llvm::Type::getInt64Ty(*TheContext);
+  auto forkBB = llvm::BasicBlock::Create(*TheContext, "par.fork", func);
+  auto serialBB = llvm::BasicBlock::Create(*TheContext, "par.serial", func);
+  auto joinBB = llvm::BasicBlock::Create(*TheContext, "par.join", func);
+  // the sequential cutoff: a load, no call into the runtime
+  auto limit =
+      cutoff ? cutoff : 2 * std::max(std::thread::hardware_concurrency(), 1u);
+  auto queued = Builder->CreateLoad(
+      i64, TheModule->getOrInsertGlobal("toy_par_queued", i64), "queued");
+  queued->setAtomic(llvm::AtomicOrdering::Monotonic);
+  queued->setAlignment(llvm::Align(8));
+  Builder->CreateCondBr(
+      Builder->CreateICmpULT(queued, llvm::ConstantInt::get(i64, limit)),
+      forkBB, serialBB);
+
+  Builder->SetInsertPoint(forkBB);
+  auto n = tasks.size();
+  auto arrayTy = llvm::ArrayType::get(ptrTy, n);
+  auto fns = createEntryAlloca(func, "par.tasks", arrayTy);
+  auto frames = createEntryAlloca(func, "par.frames", arrayTy);
+  std::vector<std::pair<llvm::StructType *, llvm::Value *>> frameOf;
+  for (size_t i = 0; i < n; i++) {
+    auto &task = tasks[i];
+    auto frameTy = frameType(task.callee);
+    auto frame = createEntryAlloca(func, "par.frame", frameTy);
+    for (size_t j = 0; j < task.args.size(); j++) {
+      Builder->CreateStore(task.args[j],
+                           Builder->CreateStructGEP(frameTy, frame, j));
+    }
+    Builder->CreateStore(
+        thunk(task.callee),
+        Builder->CreateConstInBoundsGEP2_64(arrayTy, fns, 0, i));
+    Builder->CreateStore(
+        frame, Builder->CreateConstInBoundsGEP2_64(arrayTy, frames, 0, i));
+    frameOf.emplace_back(frameTy, frame);
+  }
+  auto run = TheModule->getOrInsertFunction(
+      "toy_par_run", llvm::Type::getVoidTy(*TheContext), i64, ptrTy, ptrTy);
+  Builder->CreateCall(run, {llvm::ConstantInt::get(i64, n), fns, frames});
+  std::vector<llvm::Value *> forked;
+  for (size_t i = 0; i < n; i++) {
+    auto [frameTy, frame] = frameOf[i];
+    auto index = tasks[i].args.size();
+    forked.push_back(
+        Builder->CreateLoad(frameTy->getElementType(index),
+                            Builder->CreateStructGEP(frameTy, frame, index)));
+  }
+  auto forkEnd = Builder->GetInsertBlock();
+  Builder->CreateBr(joinBB);
+
+  Builder->SetInsertPoint(serialBB);
+  std::vector<llvm::Value *> serial;
+  for (auto &task : tasks) {
+    auto result = Builder->CreateCall(task.callee, task.args);
+    result->setCallingConv(task.callee->getCallingConv());
+    serial.push_back(result);
+  }
+  auto serialEnd = Builder->GetInsertBlock();
+  Builder->CreateBr(joinBB);
+
+  Builder->SetInsertPoint(joinBB);
+  for (size_t i = 0; i < n; i++) {
+    auto phi = Builder->CreatePHI(forked[i]->getType(), 2);
+    phi->addIncoming(forked[i], forkEnd);
+    phi->addIncoming(serial[i], serialEnd);
+    values[tasks[i].operand] = phi;
+  }
+  return combine(values);
+}
+} // namespace Toy
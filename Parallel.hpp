@@ -0,0 +1,31 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace Toy {
+// Call fn(i) for every i < n, on up to one thread per core, the calling
+// thread included. Returns once every call has.
+template <typename Fn> void parallelFor(size_t n, Fn &&fn) {
+  size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+  std::atomic<size_t> next = 0;
+  auto work = [&] {
+    for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n;) {
+      fn(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < std::min(cores, n); i++) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto &i : threads) {
+    i.join();
+  }
+}
+} // namespace Toy
+
+#endif // PARALLEL_HPP
@@ -0,0 +1,93 @@
+#include "Parse.hpp"
+#include "Parallel.hpp"
+#include "Scanner.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+
+namespace Toy {
+namespace {
+// below this, splitting costs more than it saves
+constexpr size_t minChunk = 64 << 10;
+
+bool isIdentifier(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// Offsets where top-level items begin: the first @attribute before a def
+// or extern, or the keyword itself. Braces only nest inside definitions,
+// so depth 0 is between items.
+std::vector<size_t> itemStarts(std::string_view source) {
+  std::vector<size_t> starts;
+  int depth = 0;
+  bool attributes = false;
+  for (size_t i = 0; i < source.size(); i++) {
+    auto c = source[i];
+    if (c == '{') {
+      depth++;
+    } else if (c == '}') {
+      depth = std::max(depth - 1, 0);
+    } else if (depth == 0 && (i == 0 || !isIdentifier(source[i - 1]))) {
+      auto word = [&](std::string_view keyword) {
+        return source.substr(i, keyword.size()) == keyword &&
+               (i + keyword.size() == source.size() ||
+                !isIdentifier(source[i + keyword.size()]));
+      };
+      if (c == '@' || word("def") || word("extern")) {
+        if (!attributes) {
+          starts.push_back(i);
+        }
+        attributes = c == '@';
+      }
+    }
+  }
+  return starts;
+}
+
+bool parse(std::string_view source, int line, ModuleAST &module) {
+  std::istringstream in{std::string(source)};
+  Scanner scanner(&in, false, line);
+  Parser parser(scanner, module);
+  return parser.parse() == 0;
+}
+} // namespace
+
+bool parseProgram(std::string_view source, ModuleAST &module) {
+  size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+  // a few chunks per core, for balance
+  auto target = std::max(source.size() / (4 * cores), minChunk);
+  std::vector<size_t> cuts{0};
+  if (source.size() >= 2 * minChunk && cores > 1) {
+    for (auto i : itemStarts(source)) {
+      if (i - cuts.back() >= target) {
+        cuts.push_back(i);
+      }
+    }
+  }
+  if (cuts.size() == 1) {
+    return parse(source, 1, module);
+  }
+  cuts.push_back(source.size());
+
+  auto n = cuts.size() - 1;
+  std::vector<ModuleAST> modules(n);
+  std::vector<char> ok(n);
+  std::vector<int> lines(n, 1);
+  for (size_t i = 1; i < n; i++) {
+    lines[i] = lines[i - 1] + std::count(source.begin() + cuts[i - 1],
+                                         source.begin() + cuts[i], '\n');
+  }
+  parallelFor(n, [&](size_t i) {
+    ok[i] = parse(source.substr(cuts[i], cuts[i + 1] - cuts[i]), lines[i],
+                  modules[i]);
+  });
+  if (std::find(ok.begin(), ok.end(), false) != ok.end()) {
+    return false;
+  }
+  for (auto &i : modules) {
+    module.append(std::move(i));
+  }
+  return true;
+}
+} // namespace Toy
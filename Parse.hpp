@@ -0,0 +1,16 @@
+#ifndef PARSE_HPP
+#define PARSE_HPP
+#include "AST.hpp"
+
+#include <string_view>
+
+namespace Toy {
+// Parse a whole program into module. Large sources are split at top-level
+// def, extern and @attribute boundaries and the pieces parsed concurrently,
+// each by a scanner and parser of its own; module receives the items in
+// source order either way. False on syntax errors, which are reported with
+// their lines in the whole source.
+bool parseProgram(std::string_view source, ModuleAST &module);
+} // namespace Toy
+
+#endif // PARSE_HPP
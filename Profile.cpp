@@ -0,0 +1,198 @@
+#include "Profile.hpp"
+#include "AST.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/ProfileData/InstrProf.h>
+#include <llvm/ProfileData/ProfileCommon.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+namespace Toy {
+namespace {
+struct Instrumented {
+  std::string name;
+  llvm::GlobalVariable *counters;
+  unsigned slots;
+};
+
+std::string generatePath;
+ProfileData useData;
+unsigned useGeneration = 0;
+
+// the function being compiled, on this thread
+thread_local const std::vector<uint64_t> *current = nullptr;
+thread_local Instrumented *instrumented = nullptr;
+thread_local unsigned sites = 0;
+// functions of the module being compiled
+thread_local std::deque<Instrumented> functions;
+} // namespace
+
+bool readProfile(const std::string &path, ProfileData &data) {
+  std::ifstream in(path);
+  std::string header;
+  if (!(in >> header) || header != "toy-profile") {
+    LOG_ERROR("{} is not a profile", path);
+    return false;
+  }
+  std::string name;
+  size_t n;
+  while (in >> name >> n) {
+    auto &counters = data[name];
+    counters.resize(n);
+    for (auto &i : counters) {
+      in >> i;
+    }
+  }
+  if (!in.eof()) {
+    LOG_ERROR("{} is malformed", path);
+    return false;
+  }
+  return true;
+}
+bool writeProfile(const std::string &path, const ProfileData &data) {
+  std::ofstream out(path);
+  out << "toy-profile\n";
+  for (auto &[name, counters] : data) {
+    out << name << ' ' << counters.size();
+    for (auto i : counters) {
+      out << ' ' << i;
+    }
+    out << '\n';
+  }
+  if (!out) {
+    LOG_ERROR("cannot write {}", path);
+    return false;
+  }
+  return true;
+}
+
+void setProfileGenerate(const std::string &path) { generatePath = path; }
+void setProfileUse(ProfileData data) {
+  useData = std::move(data);
+  useGeneration++;
+}
+std::string profileKey() {
+  return std::format("{}:{}", generatePath, useGeneration);
+}
+bool profileByName() { return !generatePath.empty() || !useData.empty(); }
+
+// atomic, as par() tasks may run the same function at once
+static void increment(unsigned slot, llvm::Value *by) {
+  auto ptrTy = llvm::PointerType::getUnqual(*TheContext);
+  auto i64 = llvm::Type::getInt64Ty(*TheContext);
+  auto base = Builder->CreateLoad(ptrTy, instrumented->counters);
+  auto ptr = Builder->CreateConstInBoundsGEP1_64(i64, base, slot);
+  Builder->CreateAtomicRMW(llvm::AtomicRMWInst::Add, ptr, by,
+                           llvm::MaybeAlign(8),
+                           llvm::AtomicOrdering::Monotonic);
+}
+void profileArm(unsigned site, bool then) {
+  if (instrumented) {
+    increment(1 + 2 * site + !then,
+              llvm::ConstantInt::get(llvm::Type::getInt64Ty(*TheContext), 1));
+  }
+}
+void resetProfile() {
+  current = nullptr;
+  instrumented = nullptr;
+  functions.clear();
+}
+void profileFunction(llvm::Function *func, const std::string &name,
+                     bool instrument) {
+  sites = 0;
+  instrumented = nullptr;
+  auto it = useData.find(name);
+  current = it == useData.end() ? nullptr : &it->second;
+  if (current && instrument && !current->empty()) {
+    func->setEntryCount((*current)[0]);
+  }
+  if (generatePath.empty() || !instrument) {
+    return;
+  }
+  // the counters are memory its inferred effects know nothing about
+  if (func->hasFnAttribute(llvm::Attribute::Memory)) {
+    func->setMemoryEffects(func->getMemoryEffects() |
+                           llvm::MemoryEffects(llvm::IRMemLocation::Other,
+                                               llvm::ModRefInfo::ModRef));
+  }
+  // filled in by the constructor, so a function costs one load per count
+  auto ptrTy = llvm::PointerType::getUnqual(*TheContext);
+  auto counters = new llvm::GlobalVariable(
+      *TheModule, ptrTy, false, llvm::GlobalValue::InternalLinkage,
+      llvm::ConstantPointerNull::get(ptrTy), "__toy_prof." + name);
+  functions.push_back({name, counters, 1});
+  instrumented = &functions.back();
+  increment(0, llvm::ConstantInt::get(llvm::Type::getInt64Ty(*TheContext), 1));
+}
+unsigned profileBranch() {
+  auto site = sites++;
+  if (instrumented) {
+    instrumented->slots = 1 + 2 * sites;
+  }
+  return site;
+}
+void profileSelect(unsigned site, llvm::Value *cond) {
+  if (!instrumented) {
+    return;
+  }
+  auto i64 = llvm::Type::getInt64Ty(*TheContext);
+  increment(1 + 2 * site, Builder->CreateZExt(cond, i64));
+  increment(2 + 2 * site, Builder->CreateZExt(Builder->CreateNot(cond), i64));
+}
+llvm::MDNode *profileWeights(unsigned site) {
+  if (!current || current->size() < 3 + 2 * site) {
+    return nullptr;
+  }
+  uint64_t then = (*current)[1 + 2 * site];
+  uint64_t else_ = (*current)[2 + 2 * site];
+  // weights are 32-bit, scale and keep never taken arms nonzero
+  uint64_t scale = std::max(then, else_) / UINT32_MAX + 1;
+  return llvm::MDBuilder(*TheContext)
+      .createBranchWeights(then / scale + 1, else_ / scale + 1);
+}
+
+void finishProfile(llvm::Module &module) {
+  if (!generatePath.empty() && !functions.empty()) {
+    auto &ctx = module.getContext();
+    auto ptrTy = llvm::PointerType::getUnqual(ctx);
+    auto i64 = llvm::Type::getInt64Ty(ctx);
+    auto voidTy = llvm::Type::getVoidTy(ctx);
+    auto init = module.getOrInsertFunction("toy_profile_init", voidTy, ptrTy);
+    auto alloc = module.getOrInsertFunction("toy_profile_counters", ptrTy,
+                                            ptrTy, i64);
+    auto ctor = llvm::Function::Create(llvm::FunctionType::get(voidTy, false),
+                                       llvm::GlobalValue::InternalLinkage,
+                                       "__toy_prof.register", module);
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(ctx, "entry", ctor));
+    builder.CreateCall(init, builder.CreateGlobalStringPtr(generatePath));
+    for (auto &i : functions) {
+      auto counters = builder.CreateCall(
+          alloc, {builder.CreateGlobalStringPtr(i.name),
+                  llvm::ConstantInt::get(i64, i.slots)});
+      builder.CreateStore(counters, i.counters);
+    }
+    builder.CreateRetVoid();
+    llvm::appendToGlobalCtors(module, ctor, 0);
+  }
+  resetProfile();
+
+  if (useData.empty()) {
+    return;
+  }
+  // without a summary the inliner has no notion of hot call sites
+  llvm::InstrProfSummaryBuilder summary(
+      llvm::ProfileSummaryBuilder::DefaultCutoffs);
+  for (auto &func : module) {
+    auto it = useData.find(func.getName().str());
+    if (func.isDeclaration() || it == useData.end() || it->second.empty()) {
+      continue;
+    }
+    // the first counter is taken as the entry count, as ours is
+    summary.addRecord(llvm::InstrProfRecord(it->second));
+  }
+  module.setProfileSummary(summary.getSummary()->getMD(module.getContext()),
+                           llvm::ProfileSummary::PSK_Instr);
+}
+} // namespace Toy
@@ -0,0 +1,50 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Toy {
+// Counters of one function: its entries, then a (then, else) pair for each
+// if/else in codegen order.
+using ProfileData = std::unordered_map<std::string, std::vector<uint64_t>>;
+
+// text format, one "name n c0 ... cn-1" line per function
+bool readProfile(const std::string &path, ProfileData &data);
+bool writeProfile(const std::string &path, const ProfileData &data);
+
+// Instrument functions compiled from now on, writing their counters to path
+// when the process exits. An empty path turns instrumentation off.
+void setProfileGenerate(const std::string &path);
+// attach branch weights and entry counts from data to functions compiled
+// from now on
+void setProfileUse(ProfileData data);
+// identifies the current settings, for caches of compiled code
+std::string profileKey();
+// whether counters or weights are looked up by function name, so that
+// programs differing only in names compile differently
+bool profileByName();
+
+// forget the functions of the previous module, on LLVMInit
+void resetProfile();
+// Called at the start of a function body. Counts its entries when
+// instrumenting, unless it is a batch kernel sharing the body of name.
+void profileFunction(llvm::Function *func, const std::string &name,
+                     bool instrument = true);
+// number the next if/else of the current function
+unsigned profileBranch();
+// count the taken arm at the insertion point
+void profileArm(unsigned site, bool then);
+// count either arm of a branchless if/else
+void profileSelect(unsigned site, llvm::Value *cond);
+// !prof branch weights of a site, nullptr without data
+llvm::MDNode *profileWeights(unsigned site);
+// Once the module is complete: register its counters with the runtime
+// from a constructor, or attach the profile summary the inliner reads.
+void finishProfile(llvm::Module &module);
+} // namespace Toy
+
+#endif // PROFILE_HPP
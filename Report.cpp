@@ -0,0 +1,91 @@
+#include "Report.hpp"
+#include "AST.hpp"
+
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+namespace Toy {
+namespace {
+ReportMode mode = ReportMode::Off;
+std::string path;
+
+// The function being compiled, on this thread: the slot holding its id in
+// the runtime, or nullptr if not instrumented. The ids are assigned by
+// the module's constructor, so the hook needs no lookup by name.
+thread_local llvm::GlobalVariable *current = nullptr;
+// the module's instrumented functions and their slots
+thread_local std::vector<std::pair<std::string, llvm::GlobalVariable *>>
+    instrumented;
+
+// The hooks only touch the runtime's memory, so calls to them keep
+// functions pure as far as the optimizer is concerned.
+llvm::FunctionCallee hook(const char *name, llvm::ArrayRef<llvm::Type *> args) {
+  auto type =
+      llvm::FunctionType::get(llvm::Type::getVoidTy(*TheContext), args, false);
+  auto func = llvm::cast<llvm::Function>(
+      TheModule->getOrInsertFunction(name, type).getCallee());
+  func->setMemoryEffects(llvm::MemoryEffects::inaccessibleMemOnly());
+  func->setDoesNotThrow();
+  func->setWillReturn();
+  return func;
+}
+} // namespace
+
+void setReport(ReportMode m, const std::string &p) {
+  mode = m;
+  path = p;
+}
+ReportMode getReportMode() { return mode; }
+const std::string &getReportPath() { return path; }
+std::string reportKey() {
+  return mode == ReportMode::Instrument ? "report:" + path : "";
+}
+
+void resetReport() {
+  current = nullptr;
+  instrumented.clear();
+}
+void reportEnter(const std::string &name) {
+  current = nullptr;
+  if (mode != ReportMode::Instrument) {
+    return;
+  }
+  auto i64 = llvm::Type::getInt64Ty(*TheContext);
+  current = new llvm::GlobalVariable(
+      *TheModule, i64, false, llvm::GlobalValue::InternalLinkage,
+      llvm::ConstantInt::get(i64, 0), "__toy_report." + name);
+  instrumented.emplace_back(name, current);
+  Builder->CreateCall(hook("toy_report_enter", {i64}),
+                      {Builder->CreateLoad(i64, current, "report.id")});
+}
+void reportExit() {
+  if (current) {
+    Builder->CreateCall(hook("toy_report_exit", {}));
+  }
+}
+void finishReport(llvm::Module &module) {
+  if (instrumented.empty()) {
+    return;
+  }
+  current = nullptr;
+  auto &ctx = module.getContext();
+  auto ptrTy = llvm::PointerType::getUnqual(ctx);
+  auto i64 = llvm::Type::getInt64Ty(ctx);
+  auto voidTy = llvm::Type::getVoidTy(ctx);
+  auto ctor = llvm::Function::Create(llvm::FunctionType::get(voidTy, false),
+                                     llvm::GlobalValue::InternalLinkage,
+                                     "__toy_report.init", module);
+  llvm::IRBuilder<> builder(llvm::BasicBlock::Create(ctx, "entry", ctor));
+  auto init = module.getOrInsertFunction("toy_report_init", voidTy, ptrTy);
+  builder.CreateCall(init, {builder.CreateGlobalStringPtr(path)});
+  // the runtime copies the names, the constants go with the code
+  auto function = module.getOrInsertFunction("toy_report_function", i64, ptrTy);
+  for (auto &[name, slot] : instrumented) {
+    builder.CreateStore(
+        builder.CreateCall(function, {builder.CreateGlobalStringPtr(name)}),
+        slot);
+  }
+  instrumented.clear();
+  builder.CreateRetVoid();
+  llvm::appendToGlobalCtors(module, ctor, 0);
+}
+} // namespace Toy
@@ -0,0 +1,30 @@
+#ifndef REPORT_HPP
+#define REPORT_HPP
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <string>
+
+namespace Toy {
+// --profile-report: Instrument has every function body count its calls
+// and cycles, Sample leaves the code alone and counts timer samples by
+// the function running (see startSampling). The report goes to path at
+// exit, JSON, or a table on stderr if path is empty.
+enum class ReportMode { Off, Instrument, Sample };
+void setReport(ReportMode mode, const std::string &path);
+ReportMode getReportMode();
+const std::string &getReportPath();
+// identifies the current settings, for caches of compiled code
+std::string reportKey();
+
+// forget the functions of the previous module, on LLVMInit
+void resetReport();
+// Called at the start of a function body. When instrumenting, emits the
+// entry hook, and reportExit emits the exit hook before each return.
+void reportEnter(const std::string &name);
+void reportExit();
+// once the module is complete: tell the runtime where the report goes and
+// register the instrumented functions, from a constructor
+void finishReport(llvm::Module &module);
+} // namespace Toy
+
+#endif // REPORT_HPP
@@ -0,0 +1,733 @@
+#include "Runtime.hpp"
+#include "Logger.hpp"
+#include "Profile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sys/time.h>
+#include <thread>
+#include <ucontext.h>
+#include <unordered_map>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace {
+struct ProfileRuntime {
+  std::mutex mutex;
+  std::string path;
+  // the counters stay alive after the code using them is freed
+  std::unordered_map<std::string, std::unique_ptr<uint64_t[]>> counters;
+  std::unordered_map<std::string, int64_t> sizes;
+  // replaced counters, still referenced by code compiled earlier
+  std::vector<std::unique_ptr<uint64_t[]>> retired;
+
+  void write() {
+    std::lock_guard lock(mutex);
+    Toy::ProfileData data;
+    for (auto &[name, n] : sizes) {
+      auto c = counters[name].get();
+      data[name].assign(c, c + n);
+    }
+    Toy::writeProfile(path, data);
+  }
+};
+ProfileRuntime &profileRuntime() {
+  static ProfileRuntime runtime;
+  return runtime;
+}
+
+uint64_t mix(const uint64_t *keys, int64_t arity) {
+  // splitmix64 finalizer over the key words
+  uint64_t h = arity;
+  for (int64_t i = 0; i < arity; i++) {
+    h ^= keys[i];
+    h += 0x9e3779b97f4a7c15;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+    h ^= h >> 31;
+  }
+  return h;
+}
+
+struct MemoTable {
+  std::string name;
+  int64_t arity;
+  std::atomic<uint64_t> hits = 0;
+  std::atomic<uint64_t> misses = 0;
+
+  MemoTable(std::string name, int64_t arity)
+      : name(std::move(name)), arity(arity) {}
+  virtual ~MemoTable() = default;
+  virtual bool lookup(const uint64_t *keys, uint64_t *out) = 0;
+  virtual void store(const uint64_t *keys, uint64_t value) = 0;
+};
+
+// Up to two keys: a fixed array of slots, each guarded by a sequence
+// number. Readers never block, a writer finding its slot busy drops the
+// result rather than waiting.
+class DirectMappedTable : public MemoTable {
+  static constexpr size_t size = 1 << 14;
+  struct Slot {
+    // odd while written, 0 while empty
+    std::atomic<uint32_t> seq = 0;
+    std::atomic<uint64_t> keys[2];
+    std::atomic<uint64_t> value;
+  };
+  std::unique_ptr<Slot[]> slots = std::make_unique<Slot[]>(size);
+
+public:
+  using MemoTable::MemoTable;
+  bool lookup(const uint64_t *keys, uint64_t *out) override {
+    auto &slot = slots[mix(keys, arity) & (size - 1)];
+    auto seq = slot.seq.load(std::memory_order_acquire);
+    if (seq == 0 || seq & 1) {
+      return false;
+    }
+    uint64_t k[2];
+    for (int64_t i = 0; i < arity; i++) {
+      k[i] = slot.keys[i].load(std::memory_order_relaxed);
+    }
+    auto value = slot.value.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq) {
+      return false;
+    }
+    for (int64_t i = 0; i < arity; i++) {
+      if (k[i] != keys[i]) {
+        return false;
+      }
+    }
+    *out = value;
+    return true;
+  }
+  void store(const uint64_t *keys, uint64_t value) override {
+    auto &slot = slots[mix(keys, arity) & (size - 1)];
+    auto seq = slot.seq.load(std::memory_order_relaxed);
+    if (seq & 1 || !slot.seq.compare_exchange_strong(
+                       seq, seq + 1, std::memory_order_relaxed)) {
+      return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int64_t i = 0; i < arity; i++) {
+      slot.keys[i].store(keys[i], std::memory_order_relaxed);
+    }
+    slot.value.store(value, std::memory_order_relaxed);
+    slot.seq.store(seq + 2, std::memory_order_release);
+  }
+};
+
+// More keys: a hash table behind a lock, which stops growing when full.
+class HashTable : public MemoTable {
+  static constexpr size_t capacity = 1 << 20;
+  struct Hash {
+    size_t operator()(const std::vector<uint64_t> &keys) const {
+      return mix(keys.data(), keys.size());
+    }
+  };
+  std::mutex mutex;
+  std::unordered_map<std::vector<uint64_t>, uint64_t, Hash> results;
+
+public:
+  using MemoTable::MemoTable;
+  bool lookup(const uint64_t *keys, uint64_t *out) override {
+    std::vector<uint64_t> key(keys, keys + arity);
+    std::lock_guard lock(mutex);
+    auto it = results.find(key);
+    if (it == results.end()) {
+      return false;
+    }
+    *out = it->second;
+    return true;
+  }
+  void store(const uint64_t *keys, uint64_t value) override {
+    std::vector<uint64_t> key(keys, keys + arity);
+    std::lock_guard lock(mutex);
+    if (results.size() < capacity) {
+      results.emplace(std::move(key), value);
+    }
+  }
+};
+
+struct MemoRuntime {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<MemoTable>> tables;
+};
+MemoRuntime &memoRuntime() {
+  static MemoRuntime runtime;
+  return runtime;
+}
+// print() output, written in blocks rather than a line at a time
+struct PrintRuntime {
+  static constexpr size_t capacity = 1 << 16;
+  std::mutex mutex;
+  std::string buffer;
+
+  ~PrintRuntime() { flush(); }
+  void append(const char *text, size_t n) {
+    std::lock_guard lock(mutex);
+    buffer.append(text, n);
+    if (buffer.size() >= capacity) {
+      write();
+    }
+  }
+  void flush() {
+    std::lock_guard lock(mutex);
+    write();
+  }
+  void redirect(std::string *out) {
+    std::lock_guard lock(mutex);
+    write();
+    capture = out;
+  }
+
+private:
+  void write() {
+    if (capture) {
+      capture->append(buffer);
+    } else {
+      std::fwrite(buffer.data(), 1, buffer.size(), stdout);
+      std::fflush(stdout);
+    }
+    buffer.clear();
+  }
+  std::string *capture = nullptr;
+};
+PrintRuntime &printRuntime() {
+  static PrintRuntime runtime;
+  return runtime;
+}
+
+// One deque per worker: the owner pushes and pops at the back, idle
+// workers steal the oldest task at the front. Threads outside the pool
+// share one more deque.
+class TaskPool {
+  struct Task {
+    void (*fn)(void *);
+    void *frame;
+    std::atomic<int64_t> *join;
+  };
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::mutex sleepMutex;
+  std::condition_variable sleep;
+  bool stopping = false;
+  static thread_local Queue *self;
+
+  std::atomic_ref<int64_t> queued() { return std::atomic_ref(toy_par_queued); }
+  bool take(Queue &queue, bool back, Task &task) {
+    std::lock_guard lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      return false;
+    }
+    if (back) {
+      task = queue.tasks.back();
+      queue.tasks.pop_back();
+    } else {
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+    }
+    return true;
+  }
+  // run one task, our own newest first, else the oldest of another queue
+  bool runOne(size_t seed) {
+    Task task;
+    bool found = self && take(*self, true, task);
+    for (size_t i = 0; !found && i < queues.size(); i++) {
+      found = take(*queues[(seed + i) % queues.size()], false, task);
+    }
+    if (!found) {
+      return false;
+    }
+    queued().fetch_sub(1, std::memory_order_relaxed);
+    task.fn(task.frame);
+    task.join->fetch_sub(1, std::memory_order_release);
+    return true;
+  }
+  void work(size_t index) {
+    self = queues[index].get();
+    while (true) {
+      if (runOne(index)) {
+        continue;
+      }
+      std::unique_lock lock(sleepMutex);
+      sleep.wait(lock, [&] {
+        return stopping || queued().load(std::memory_order_relaxed) > 0;
+      });
+      if (stopping) {
+        return;
+      }
+    }
+  }
+
+public:
+  TaskPool() {
+    auto n = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    for (unsigned i = 0; i <= n; i++) {
+      queues.push_back(std::make_unique<Queue>());
+    }
+    // the last queue is shared by threads outside the pool
+    for (unsigned i = 0; i < n; i++) {
+      threads.emplace_back([this, i] { work(i); });
+    }
+  }
+  ~TaskPool() {
+    {
+      std::lock_guard lock(sleepMutex);
+      stopping = true;
+    }
+    sleep.notify_all();
+    for (auto &i : threads) {
+      i.join();
+    }
+  }
+  void run(int64_t n, void (*const *tasks)(void *), void *const *frames) {
+    std::atomic<int64_t> join = n - 1;
+    auto &queue = self ? *self : *queues.back();
+    {
+      std::lock_guard lock(queue.mutex);
+      for (int64_t i = 0; i < n - 1; i++) {
+        queue.tasks.push_back({tasks[i], frames[i], &join});
+      }
+    }
+    queued().fetch_add(n - 1, std::memory_order_relaxed);
+    {
+      // pairs with the predicate check of sleeping workers
+      std::lock_guard lock(sleepMutex);
+    }
+    sleep.notify_all();
+    tasks[n - 1](frames[n - 1]);
+    // help rather than block, the tasks we wait for may be ours
+    auto seed = reinterpret_cast<uintptr_t>(&join) / 64;
+    while (join.load(std::memory_order_acquire) > 0) {
+      if (!runOne(seed)) {
+        std::this_thread::yield();
+      }
+    }
+  }
+};
+thread_local TaskPool::Queue *TaskPool::self = nullptr;
+TaskPool &taskPool() {
+  static TaskPool pool;
+  return pool;
+}
+
+// --profile-report. Instrumented functions count on the thread running
+// them, the threads' counters are summed at exit. Samples are counted by
+// the function whose code the timer signal interrupted.
+uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Only the thread itself counts, write() reads the counts at exit while
+// other threads may still run, through relaxed atomic_refs
+struct ReportCounters {
+  alignas(8) uint64_t calls = 0;
+  alignas(8) uint64_t inclusive = 0;
+  alignas(8) uint64_t exclusive = 0;
+  // activations on the stack, so that recursion adds to inclusive once
+  uint64_t active = 0;
+};
+struct ReportFrame {
+  int64_t function;
+  uint64_t start;
+  uint64_t children;
+};
+struct ReportThread {
+  // held to grow counters and to read them from another thread
+  std::mutex mutex;
+  // by function id, see toy_report_function
+  std::vector<ReportCounters> counters;
+  std::vector<ReportFrame> stack;
+};
+
+// code of one function, for samples
+struct CodeRange {
+  uint64_t start;
+  uint64_t end;
+  size_t function;
+};
+
+struct ReportRuntime;
+ReportRuntime &reportRuntime();
+
+struct ReportRuntime {
+  static constexpr size_t maxFunctions = 1 << 16;
+  std::mutex mutex;
+  bool registered = false;
+  std::string path;
+  // kept after their threads exit
+  std::vector<std::shared_ptr<ReportThread>> threads;
+  // instrumented functions by id, outliving their code
+  std::vector<std::string> names;
+  std::unordered_map<std::string, int64_t> ids;
+
+  unsigned period = 0;
+  std::vector<std::string> sampled;
+  std::unique_ptr<std::atomic<uint64_t>[]> samples{
+      new std::atomic<uint64_t>[maxFunctions]()};
+  std::atomic<uint64_t> unknownSamples = 0;
+  // sorted by start, replaced as a whole so the signal handler never
+  // sees a table being changed; old tables stay alive
+  std::atomic<const std::vector<CodeRange> *> ranges = nullptr;
+  std::vector<std::unique_ptr<std::vector<CodeRange>>> tables;
+
+  // write at exit, once
+  void atExit(const std::string &file) {
+    std::lock_guard lock(mutex);
+    path = file;
+    if (!registered) {
+      registered = true;
+      std::atexit([] { reportRuntime().write(); });
+    }
+  }
+  void write();
+};
+ReportRuntime &reportRuntime() {
+  static ReportRuntime runtime;
+  return runtime;
+}
+
+ReportThread &reportThread() {
+  thread_local auto thread = [] {
+    auto thread = std::make_shared<ReportThread>();
+    thread->stack.reserve(256);
+    auto &runtime = reportRuntime();
+    std::lock_guard lock(runtime.mutex);
+    runtime.threads.push_back(thread);
+    return thread.get();
+  }();
+  return *thread;
+}
+
+void onSample(int, siginfo_t *, void *context) {
+  uint64_t pc = 0;
+#if defined(__linux__) && defined(__x86_64__)
+  pc = static_cast<ucontext_t *>(context)->uc_mcontext.gregs[REG_RIP];
+#elif defined(__linux__) && defined(__aarch64__)
+  pc = static_cast<ucontext_t *>(context)->uc_mcontext.pc;
+#endif
+  auto &runtime = reportRuntime();
+  if (auto ranges = runtime.ranges.load(std::memory_order_acquire)) {
+    auto it = std::upper_bound(
+        ranges->begin(), ranges->end(), pc,
+        [](uint64_t pc, const CodeRange &range) { return pc < range.start; });
+    if (it != ranges->begin() && pc < (--it)->end) {
+      runtime.samples[it->function].fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  runtime.unknownSamples.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t readCount(uint64_t &counter) {
+  return std::atomic_ref(counter).load(std::memory_order_relaxed);
+}
+// a load and a store rather than fetch_add: the counting thread is the
+// only writer
+void addCount(uint64_t &counter, uint64_t n) {
+  std::atomic_ref(counter).store(readCount(counter) + n,
+                                 std::memory_order_relaxed);
+}
+
+std::string jsonString(const std::string &s) {
+  std::string quoted = "\"";
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (c == '\n') {
+      quoted += "\\n";
+    } else if (c == '\t') {
+      quoted += "\\t";
+    } else if (c < 0x20) {
+      quoted += std::format("\\u{:04x}", c);
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + '"';
+}
+
+void ReportRuntime::write() {
+  std::lock_guard lock(mutex);
+  if (period) {
+    itimerval off{};
+    setitimer(ITIMER_PROF, &off, nullptr);
+  }
+  std::vector<ReportCounters> functions(names.size());
+  for (auto &thread : threads) {
+    std::lock_guard lock(thread->mutex);
+    for (size_t i = 0; i < thread->counters.size(); i++) {
+      auto &sum = functions[i];
+      sum.calls += readCount(thread->counters[i].calls);
+      sum.inclusive += readCount(thread->counters[i].inclusive);
+      sum.exclusive += readCount(thread->counters[i].exclusive);
+    }
+  }
+  std::vector<size_t> byTime;
+  uint64_t total = 0;
+  for (size_t i = 0; i < functions.size(); i++) {
+    if (functions[i].calls) {
+      byTime.push_back(i);
+      total += functions[i].exclusive;
+    }
+  }
+  std::sort(byTime.begin(), byTime.end(), [&](auto a, auto b) {
+    return functions[a].exclusive > functions[b].exclusive;
+  });
+  std::map<std::string, uint64_t> bySamples;
+  uint64_t sampleCount = unknownSamples;
+  for (size_t i = 0; i < sampled.size(); i++) {
+    if (auto n = samples[i].load()) {
+      bySamples[sampled[i]] += n;
+      sampleCount += n;
+    }
+  }
+  std::vector<std::pair<std::string, uint64_t>> sampledByCount(
+      bySamples.begin(), bySamples.end());
+  std::sort(sampledByCount.begin(), sampledByCount.end(),
+            [](auto &a, auto &b) { return a.second > b.second; });
+
+  std::string out;
+  if (path.empty()) {
+    if (!byTime.empty()) {
+      out += std::format("{:<24} {:>12} {:>18} {:>18} {:>7}\n", "function",
+                         "calls", "inclusive cycles", "exclusive cycles",
+                         "self %");
+    }
+    for (auto i : byTime) {
+      auto &f = functions[i];
+      out += std::format("{:<24} {:>12} {:>18} {:>18} {:>7.2f}\n", names[i],
+                         f.calls, f.inclusive, f.exclusive,
+                         total ? 100.0 * f.exclusive / total : 0.0);
+    }
+    if (period) {
+      out += std::format("{} samples every {} us of CPU time\n", sampleCount,
+                         period);
+      for (auto &[name, n] : sampledByCount) {
+        out += std::format("{:<24} {:>12} {:>7.2f}%\n", name, n,
+                           100.0 * n / sampleCount);
+      }
+      if (unknownSamples) {
+        out += std::format("{:<24} {:>12} {:>7.2f}%\n", "(other code)",
+                           unknownSamples.load(),
+                           100.0 * unknownSamples / sampleCount);
+      }
+    }
+    std::fwrite(out.data(), 1, out.size(), stderr);
+    return;
+  }
+  out += "{\"unit\": \"cycles\", \"functions\": [";
+  for (size_t i = 0; i < byTime.size(); i++) {
+    auto &f = functions[byTime[i]];
+    out += std::format("{}\n  {{\"name\": {}, \"calls\": {}, "
+                       "\"inclusive\": {}, \"exclusive\": {}}}",
+                       i ? "," : "", jsonString(names[byTime[i]]), f.calls,
+                       f.inclusive, f.exclusive);
+  }
+  out += std::format("],\n \"sample_period_us\": {}, \"samples\": [",
+                     period);
+  for (size_t i = 0; i < sampledByCount.size(); i++) {
+    out += std::format("{}\n  {{\"name\": {}, \"samples\": {}}}",
+                       i ? "," : "", jsonString(sampledByCount[i].first),
+                       sampledByCount[i].second);
+  }
+  out += std::format("],\n \"other_samples\": {}}}\n",
+                     unknownSamples.load());
+  auto file = std::fopen(path.c_str(), "w");
+  if (!file) {
+    LOG_ERROR("cannot write {}", path);
+    return;
+  }
+  std::fwrite(out.data(), 1, out.size(), file);
+  std::fclose(file);
+}
+} // namespace
+
+extern "C" {
+void toy_profile_init(const char *path) {
+  auto &runtime = profileRuntime();
+  std::lock_guard lock(runtime.mutex);
+  if (runtime.path.empty()) {
+    std::atexit([] { profileRuntime().write(); });
+  }
+  runtime.path = path;
+}
+uint64_t *toy_profile_counters(const char *name, int64_t n) {
+  auto &runtime = profileRuntime();
+  std::lock_guard lock(runtime.mutex);
+  auto &c = runtime.counters[name];
+  auto &size = runtime.sizes[name];
+  if (c && size == n) {
+    // compiled again, keep counting
+    return c.get();
+  }
+  if (c) {
+    LOG_WARN("{} changed shape, dropping its counters", std::string(name));
+    runtime.retired.push_back(std::move(c));
+  }
+  c = std::make_unique<uint64_t[]>(n);
+  size = n;
+  return c.get();
+}
+
+void *toy_memo_table(const char *name, int64_t arity) {
+  std::unique_ptr<MemoTable> table;
+  if (arity <= 2) {
+    table = std::make_unique<DirectMappedTable>(name, arity);
+  } else {
+    table = std::make_unique<HashTable>(name, arity);
+  }
+  auto &runtime = memoRuntime();
+  std::lock_guard lock(runtime.mutex);
+  runtime.tables.push_back(std::move(table));
+  return runtime.tables.back().get();
+}
+int32_t toy_memo_lookup(void *table, const uint64_t *keys, uint64_t *out) {
+  auto memo = static_cast<MemoTable *>(table);
+  bool hit = memo->lookup(keys, out);
+  (hit ? memo->hits : memo->misses).fetch_add(1, std::memory_order_relaxed);
+  return hit;
+}
+void toy_memo_store(void *table, const uint64_t *keys, uint64_t value) {
+  static_cast<MemoTable *>(table)->store(keys, value);
+}
+
+double toy_print_double(double x) {
+  // as std::ostream prints it
+  char text[32];
+  auto n = std::snprintf(text, sizeof(text), "%g\n", x);
+  printRuntime().append(text, n);
+  return x;
+}
+int64_t toy_print_int(int64_t x) {
+  char text[24];
+  auto end = std::to_chars(text, text + sizeof(text) - 1, x).ptr;
+  *end++ = '\n';
+  printRuntime().append(text, end - text);
+  return x;
+}
+void toy_print_flush() { printRuntime().flush(); }
+
+void toy_report_init(const char *path) { reportRuntime().atExit(path); }
+int64_t toy_report_function(const char *name) {
+  auto &runtime = reportRuntime();
+  std::lock_guard lock(runtime.mutex);
+  auto [it, added] = runtime.ids.try_emplace(name, runtime.names.size());
+  if (added) {
+    runtime.names.push_back(name);
+  }
+  return it->second;
+}
+void toy_report_enter(int64_t id) {
+  auto &thread = reportThread();
+  if (static_cast<size_t>(id) >= thread.counters.size()) {
+    std::lock_guard lock(thread.mutex);
+    thread.counters.resize(id + 1);
+  }
+  thread.counters[id].active++;
+  thread.stack.push_back({id, cycles(), 0});
+}
+void toy_report_exit() {
+  auto end = cycles();
+  auto &thread = reportThread();
+  if (thread.stack.empty()) {
+    return;
+  }
+  auto frame = thread.stack.back();
+  thread.stack.pop_back();
+  auto elapsed = end - frame.start;
+  auto &counters = thread.counters[frame.function];
+  addCount(counters.calls, 1);
+  addCount(counters.exclusive, elapsed - std::min(frame.children, elapsed));
+  if (--counters.active == 0) {
+    addCount(counters.inclusive, elapsed);
+  }
+  if (!thread.stack.empty()) {
+    thread.stack.back().children += elapsed;
+  }
+}
+
+alignas(8) int64_t toy_par_queued = 0;
+void toy_par_run(int64_t n, void (*const *tasks)(void *),
+                 void *const *frames) {
+  if (n > 0) {
+    taskPool().run(n, tasks, frames);
+  }
+}
+}
+
+std::vector<Toy::MemoStats> Toy::memoStats() {
+  auto &runtime = memoRuntime();
+  std::lock_guard lock(runtime.mutex);
+  std::vector<MemoStats> stats;
+  for (auto &i : runtime.tables) {
+    stats.push_back({i->name, i->hits.load(), i->misses.load()});
+  }
+  return stats;
+}
+void Toy::capturePrint(std::string *out) { printRuntime().redirect(out); }
+
+void Toy::reportCode(uint64_t start, uint64_t size, const std::string &name) {
+  auto &runtime = reportRuntime();
+  std::lock_guard lock(runtime.mutex);
+  if (runtime.sampled.size() == ReportRuntime::maxFunctions) {
+    return;
+  }
+  auto current = runtime.ranges.load();
+  auto table = current ? std::make_unique<std::vector<CodeRange>>(*current)
+                       : std::make_unique<std::vector<CodeRange>>();
+  CodeRange range{start, start + size, runtime.sampled.size()};
+  table->insert(std::upper_bound(table->begin(), table->end(), range,
+                                 [](auto &a, auto &b) {
+                                   return a.start < b.start;
+                                 }),
+                range);
+  runtime.sampled.push_back(name);
+  runtime.ranges.store(table.get(), std::memory_order_release);
+  runtime.tables.push_back(std::move(table));
+}
+bool Toy::startSampling(const std::string &path, unsigned period) {
+  auto &runtime = reportRuntime();
+  runtime.atExit(path);
+  {
+    std::lock_guard lock(runtime.mutex);
+    runtime.period = period;
+  }
+  struct sigaction action{};
+  action.sa_sigaction = onSample;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  itimerval timer{};
+  timer.it_interval.tv_sec = period / 1000000;
+  timer.it_interval.tv_usec = period % 1000000;
+  timer.it_value = timer.it_interval;
+  if (sigaction(SIGPROF, &action, nullptr) ||
+      setitimer(ITIMER_PROF, &timer, nullptr)) {
+    LOG_ERROR("cannot start sampling: {}", std::strerror(errno));
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,65 @@
+#ifndef RUNTIME_HPP
+#define RUNTIME_HPP
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Support functions generated code calls into. The JIT binds them by
+// address, ahead-of-time compiled code links against the library.
+extern "C" {
+// write the profile to path at exit
+void toy_profile_init(const char *path);
+// counters of a function, zeroed and kept until exit
+uint64_t *toy_profile_counters(const char *name, int64_t n);
+
+// A memo table of a function taking arity scalars, kept until exit. Keys
+// and results are the bits of the values.
+void *toy_memo_table(const char *name, int64_t arity);
+// nonzero on a hit, with the result stored to out
+int32_t toy_memo_lookup(void *table, const uint64_t *keys, uint64_t *out);
+void toy_memo_store(void *table, const uint64_t *keys, uint64_t value);
+
+// print(x): append x and a newline to a buffer written out when full and
+// at exit, and return x
+double toy_print_double(double x);
+int64_t toy_print_int(int64_t x);
+// write out what print() buffered so far
+void toy_print_flush();
+
+// Fork-join on the work-stealing pool: run tasks[i](frames[i]) for i < n
+// and return once all have. The caller runs the last task itself, and
+// others while it waits.
+void toy_par_run(int64_t n, void (*const *tasks)(void *), void *const *frames);
+// tasks waiting in the pool, read by compiled code without a call
+extern int64_t toy_par_queued;
+
+// --profile-report: write the report of instrumented functions and samples
+// to path at exit, a table on stderr if empty
+void toy_report_init(const char *path);
+// the id of an instrumented function, the same for the same name
+int64_t toy_report_function(const char *name);
+// entry and exit of an instrumented function body, on the calling thread
+void toy_report_enter(int64_t id);
+void toy_report_exit();
+}
+
+namespace Toy {
+struct MemoStats {
+  std::string name;
+  uint64_t hits;
+  uint64_t misses;
+};
+// every memo table created so far
+std::vector<MemoStats> memoStats();
+// Collect print() output in out instead of writing it to stdout, until
+// called again with nullptr. Flushes what was buffered before.
+void capturePrint(std::string *out);
+// code of function name at [start, start + size), for samples to name
+void reportCode(uint64_t start, uint64_t size, const std::string &name);
+// Sample the running function on a timer of period microseconds of CPU
+// time (SIGPROF), and write the report to path at exit, see
+// toy_report_init. Only code passed to reportCode is told apart.
+bool startSampling(const std::string &path, unsigned period = 1000);
+} // namespace Toy
+
+#endif // RUNTIME_HPP
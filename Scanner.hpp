@@ -14,14 +14,23 @@
 namespace Toy {
 class Scanner : public yyFlexLexer {
 public:
-  explicit Scanner(std::istream *in) : yyFlexLexer(in) {}
+  // line is that of the input's start within the whole source
+  explicit Scanner(std::istream *in, bool stream = false, int line = 1)
+      : yyFlexLexer(in),
+        start(stream ? Parser::token::START_STREAM
+                     : Parser::token::START_PROGRAM),
+        firstLine(line) {}
 
   using FlexLexer::yylex;
   virtual int yylex(Parser::value_type *yylval, Parser::location_type *loc);
+  int getFirstLine() const { return firstLine; }
 
 private:
   Parser::semantic_type *yylval{};
   location loc;
+  // token returned before the input to select the parse mode
+  int start;
+  int firstLine;
 };
 } // namespace Toy
 #undef YY_DECL
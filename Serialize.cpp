@@ -0,0 +1,459 @@
+#include "Serialize.hpp"
+#include "AST.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <llvm/Support/MemoryBuffer.h>
+
+namespace Toy {
+namespace {
+constexpr std::string_view magic{"TOYAST\0\0", 8};
+constexpr uint32_t version = 1;
+// Nodes nest at most this deep. The reader recurses once per level, as
+// does codegen, so crafted data must not nest deeper than the stack holds.
+constexpr unsigned maxDepth = 4096;
+
+template <typename T> void append(std::string &out, T value) {
+  auto bits = std::bit_cast<std::array<char, sizeof(T)>>(value);
+  if constexpr (std::endian::native == std::endian::big) {
+    std::reverse(bits.begin(), bits.end());
+  }
+  out.append(bits.data(), bits.size());
+}
+} // namespace
+
+void ASTWriter::u32(uint32_t value) { append(nodes, value); }
+void ASTWriter::i64(int64_t value) { append(nodes, value); }
+void ASTWriter::f64(double value) { append(nodes, value); }
+void ASTWriter::string(const std::string &str) {
+  auto [it, inserted] = ids.try_emplace(str, strings.size());
+  if (inserted) {
+    strings.push_back(&it->first);
+  }
+  u32(it->second);
+}
+std::string ASTWriter::finish() const {
+  std::string out(magic);
+  append(out, version);
+  append(out, static_cast<uint32_t>(strings.size()));
+  for (auto i : strings) {
+    append(out, static_cast<uint32_t>(i->size()));
+    out += *i;
+  }
+  return out + nodes;
+}
+
+static void writeParameter(ASTWriter &w, const Parameter &p) {
+  w.string(p.name);
+  w.byte(static_cast<uint8_t>(p.annotated ? p.type : Type::Unknown));
+}
+
+void NumberExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::Number);
+  w.f64(value);
+}
+void IntegerExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::Integer);
+  w.i64(value);
+}
+void VariableExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::Variable);
+  w.string(name);
+}
+void BinaryExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::Binary);
+  w.byte(static_cast<uint8_t>(opcode));
+  lhs->serialize(w);
+  rhs->serialize(w);
+}
+void CallExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::Call);
+  w.string(callee);
+  w.u32(arguments.size());
+  for (auto &i : arguments) {
+    i->serialize(w);
+  }
+}
+void PrototypeAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::Prototype);
+  w.string(name);
+  w.u32(arguments.size());
+  for (auto &i : arguments) {
+    writeParameter(w, i);
+  }
+  w.byte(static_cast<uint8_t>(ret.annotated ? ret.type : Type::Unknown));
+  w.u32(attributes.size());
+  for (auto &i : attributes) {
+    w.string(i);
+  }
+}
+void FunctionAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::Function);
+  proto->serialize(w);
+  body->serialize(w);
+}
+void IfElseExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::IfElse);
+  condition->serialize(w);
+  then->serialize(w);
+  else_->serialize(w);
+}
+void BlockExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::Block);
+  w.u32(exprs.size());
+  for (auto &i : exprs) {
+    i->serialize(w);
+  }
+}
+void VarExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::Var);
+  writeParameter(w, var);
+  init->serialize(w);
+}
+void AssignExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::Assign);
+  w.string(name);
+  value->serialize(w);
+}
+void WhileExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::While);
+  condition->serialize(w);
+  body->serialize(w);
+}
+void ForExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::For);
+  w.string(var.name);
+  start->serialize(w);
+  condition->serialize(w);
+  w.byte(step != nullptr);
+  if (step) {
+    step->serialize(w);
+  }
+  body->serialize(w);
+}
+void IndexExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::Index);
+  w.string(name);
+  index->serialize(w);
+  w.byte(value != nullptr);
+  if (value) {
+    value->serialize(w);
+  }
+}
+void ParExprAST::serialize(ASTWriter &w) const {
+  w.tag(NodeTag::Par);
+  expr->serialize(w);
+}
+void ModuleAST::serialize(ASTWriter &w) const {
+  w.u32(externs.size());
+  for (auto &i : externs) {
+    i->serialize(w);
+  }
+  w.u32(functions.size());
+  for (auto &i : functions) {
+    i->serialize(w);
+  }
+}
+
+namespace {
+// Reads serializeAST() output in place. Any read past the end or invalid
+// value sets failed, and reads after that return zeros.
+class ASTReader {
+  std::string_view data;
+  size_t pos = 0;
+  std::vector<std::string_view> strings;
+  unsigned depth = 0;
+
+  template <typename T> T read() {
+    std::array<char, sizeof(T)> bits{};
+    if (data.size() - pos < sizeof(T)) {
+      failed = true;
+    } else {
+      std::memcpy(bits.data(), data.data() + pos, sizeof(T));
+      pos += sizeof(T);
+    }
+    if constexpr (std::endian::native == std::endian::big) {
+      std::reverse(bits.begin(), bits.end());
+    }
+    return std::bit_cast<T>(bits);
+  }
+  uint8_t byte() { return read<uint8_t>(); }
+  uint32_t u32() { return read<uint32_t>(); }
+  std::string string() {
+    auto i = u32();
+    if (i >= strings.size()) {
+      failed = true;
+      return {};
+    }
+    return std::string(strings[i]);
+  }
+  Type type() {
+    auto t = byte();
+    if (t > static_cast<uint8_t>(Type::Array)) {
+      failed = true;
+      return Type::Unknown;
+    }
+    return static_cast<Type>(t);
+  }
+  Parameter parameter() {
+    auto name = string();
+    auto t = type();
+    return {name, t, t != Type::Unknown};
+  }
+  std::unique_ptr<ExprAST> optional() {
+    return byte() ? expr() : nullptr;
+  }
+
+public:
+  bool failed = false;
+
+  // a count of items taking at least one byte each
+  uint32_t count() {
+    auto n = u32();
+    if (n > data.size() - pos) {
+      failed = true;
+      return 0;
+    }
+    return n;
+  }
+
+  explicit ASTReader(std::string_view data) : data(data) {}
+  bool header() {
+    if (data.substr(0, magic.size()) != magic) {
+      return false;
+    }
+    pos = magic.size();
+    if (auto v = u32(); v != version) {
+      LOG_ERROR("AST version {}, expected {}", v, version);
+      failed = true;
+      return false;
+    }
+    auto n = count();
+    for (uint32_t i = 0; i < n && !failed; i++) {
+      auto size = u32();
+      if (size > data.size() - pos) {
+        failed = true;
+        break;
+      }
+      strings.push_back(data.substr(pos, size));
+      pos += size;
+    }
+    return !failed;
+  }
+  std::unique_ptr<PrototypeAST> prototype() {
+    if (byte() != static_cast<uint8_t>(NodeTag::Prototype)) {
+      failed = true;
+      return nullptr;
+    }
+    auto name = string();
+    std::vector<Parameter> args(count());
+    for (auto &i : args) {
+      i = parameter();
+    }
+    auto ret = type();
+    std::vector<std::string> attrs(count());
+    for (auto &i : attrs) {
+      i = string();
+      failed |= !PrototypeAST::isAttribute(i);
+    }
+    auto proto = std::make_unique<PrototypeAST>(name, std::move(args), ret);
+    proto->setAttributes(std::move(attrs));
+    return proto;
+  }
+  std::unique_ptr<FunctionAST> function() {
+    if (byte() != static_cast<uint8_t>(NodeTag::Function)) {
+      failed = true;
+      return nullptr;
+    }
+    auto proto = prototype();
+    auto body = expr();
+    if (failed) {
+      return nullptr;
+    }
+    return std::make_unique<FunctionAST>(proto.release(), body.release());
+  }
+  std::unique_ptr<ExprAST> expr() {
+    if (depth == maxDepth) {
+      if (!failed) {
+        LOG_ERROR("serialized AST nested deeper than {}", maxDepth);
+      }
+      failed = true;
+    }
+    if (failed) {
+      return nullptr;
+    }
+    depth++;
+    auto e = node();
+    depth--;
+    return e;
+  }
+  std::unique_ptr<ExprAST> node() {
+    auto tag = static_cast<NodeTag>(byte());
+    std::unique_ptr<ExprAST> e;
+    switch (tag) {
+    case NodeTag::Number:
+      e = std::make_unique<NumberExprAST>(read<double>());
+      break;
+    case NodeTag::Integer:
+      e = std::make_unique<IntegerExprAST>(read<int64_t>());
+      break;
+    case NodeTag::Variable:
+      e = std::make_unique<VariableExprAST>(string());
+      break;
+    case NodeTag::Binary: {
+      auto op = byte();
+      failed |= op > static_cast<uint8_t>(BinaryExprAST::OpType::NE);
+      auto l = expr();
+      auto r = expr();
+      if (!failed) {
+        e = std::make_unique<BinaryExprAST>(
+            static_cast<BinaryExprAST::OpType>(op), l.release(), r.release());
+      }
+      break;
+    }
+    case NodeTag::Call: {
+      auto callee = string();
+      std::vector<std::unique_ptr<ExprAST>> args(count());
+      for (auto &i : args) {
+        i = expr();
+      }
+      e = std::make_unique<CallExprAST>(callee, args);
+      break;
+    }
+    case NodeTag::IfElse: {
+      auto c = expr();
+      auto t = expr();
+      auto f = expr();
+      if (!failed) {
+        e = std::make_unique<IfElseExprAST>(c.release(), t.release(),
+                                            f.release());
+      }
+      break;
+    }
+    case NodeTag::Block: {
+      std::vector<std::unique_ptr<ExprAST>> exprs(count());
+      for (auto &i : exprs) {
+        i = expr();
+      }
+      e = std::make_unique<BlockExprAST>(exprs);
+      break;
+    }
+    case NodeTag::Var: {
+      auto var = parameter();
+      auto init = expr();
+      if (!failed) {
+        e = std::make_unique<VarExprAST>(var, init.release());
+      }
+      break;
+    }
+    case NodeTag::Assign: {
+      auto name = string();
+      auto value = expr();
+      if (!failed) {
+        e = std::make_unique<AssignExprAST>(name, value.release());
+      }
+      break;
+    }
+    case NodeTag::While: {
+      auto c = expr();
+      auto b = expr();
+      if (!failed) {
+        e = std::make_unique<WhileExprAST>(c.release(), b.release());
+      }
+      break;
+    }
+    case NodeTag::For: {
+      auto name = string();
+      auto start = expr();
+      auto c = expr();
+      auto step = optional();
+      auto body = expr();
+      if (!failed) {
+        e = std::make_unique<ForExprAST>(name, start.release(), c.release(),
+                                         step.release(), body.release());
+      }
+      break;
+    }
+    case NodeTag::Index: {
+      auto name = string();
+      auto index = expr();
+      auto value = optional();
+      if (!failed) {
+        e = std::make_unique<IndexExprAST>(name, index.release(),
+                                           value.release());
+      }
+      break;
+    }
+    case NodeTag::Par: {
+      auto inner = expr();
+      // as the parser only accepts
+      failed |= !dynamic_cast<BinaryExprAST *>(inner.get()) &&
+                !dynamic_cast<CallExprAST *>(inner.get());
+      if (!failed) {
+        e = std::make_unique<ParExprAST>(inner.release());
+      }
+      break;
+    }
+    default:
+      failed = true;
+    }
+    if (failed) {
+      return nullptr;
+    }
+    return e;
+  }
+  bool done() const { return pos == data.size(); }
+};
+} // namespace
+
+std::string serializeAST(const ModuleAST &module) {
+  ASTWriter w;
+  module.serialize(w);
+  return w.finish();
+}
+bool writeAST(const std::string &path, const ModuleAST &module) {
+  std::ofstream out(path, std::ios::binary);
+  out << serializeAST(module);
+  if (!out) {
+    LOG_ERROR("cannot write {}", path);
+    return false;
+  }
+  return true;
+}
+bool isSerializedAST(std::string_view data) { return data.starts_with(magic); }
+bool deserializeAST(std::string_view data, ModuleAST &module) {
+  ASTReader r(data);
+  if (!r.header()) {
+    if (!r.failed) {
+      LOG_ERROR("not a serialized AST");
+    }
+    return false;
+  }
+  auto read = [&](auto item, auto add) {
+    auto n = r.count();
+    for (uint32_t i = 0; i < n && !r.failed; i++) {
+      if (auto p = (r.*item)()) {
+        add(p.release());
+      }
+    }
+  };
+  read(&ASTReader::prototype, [&](PrototypeAST *p) { module.addExtern(p); });
+  read(&ASTReader::function, [&](FunctionAST *f) { module.addFunction(f); });
+  if (r.failed || !r.done()) {
+    LOG_ERROR("malformed serialized AST");
+    return false;
+  }
+  return true;
+}
+bool readAST(const std::string &path, ModuleAST &module) {
+  auto buffer = llvm::MemoryBuffer::getFile(path, false, false);
+  if (!buffer) {
+    LOG_ERROR("cannot read {}: {}", path, buffer.getError().message());
+    return false;
+  }
+  return deserializeAST((*buffer)->getBuffer(), module);
+}
+} // namespace Toy
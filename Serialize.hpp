@@ -0,0 +1,64 @@
+#ifndef SERIALIZE_HPP
+#define SERIALIZE_HPP
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Toy {
+class ModuleAST;
+
+// Binary form of a parsed program, to compile it again without the flex
+// and Bison front end: a magic number and version, an interned string
+// table, then the externs and functions as trees of tagged nodes. Numbers
+// are little-endian. Types are the annotated ones, so a program written
+// after type inference reads back as parsed. Bump the version with any
+// change to the encoding.
+bool writeAST(const std::string &path, const ModuleAST &module);
+// maps the file rather than reading it, false on a foreign version or
+// malformed data, which is logged
+bool readAST(const std::string &path, ModuleAST &module);
+std::string serializeAST(const ModuleAST &module);
+bool deserializeAST(std::string_view data, ModuleAST &module);
+// whether data starts like serializeAST() output
+bool isSerializedAST(std::string_view data);
+
+enum class NodeTag : uint8_t {
+  Number,
+  Integer,
+  Variable,
+  Binary,
+  Call,
+  Prototype,
+  Function,
+  IfElse,
+  Block,
+  Var,
+  Assign,
+  While,
+  For,
+  Index,
+  Par,
+};
+
+class ASTWriter {
+public:
+  void tag(NodeTag tag) { byte(static_cast<uint8_t>(tag)); }
+  void byte(uint8_t value) { nodes += static_cast<char>(value); }
+  void u32(uint32_t value);
+  void i64(int64_t value);
+  void f64(double value);
+  // by index into the string table
+  void string(const std::string &str);
+  // the header and string table, then the nodes
+  std::string finish() const;
+
+private:
+  std::string nodes;
+  std::unordered_map<std::string, uint32_t> ids;
+  std::vector<const std::string *> strings;
+};
+} // namespace Toy
+
+#endif // SERIALIZE_HPP
@@ -0,0 +1,437 @@
+#include "Server.hpp"
+#include "AST.hpp"
+#include "Emit.hpp"
+#include "Optimizer.hpp"
+#include "Parse.hpp"
+#include "Profile.hpp"
+#include "Report.hpp"
+#include "Runtime.hpp"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace Toy {
+namespace {
+// bound on the strings a message may announce, and on their total size,
+// which is allocated before the bytes arrive
+constexpr uint32_t maxFields = 1 << 16;
+constexpr size_t maxMessage = 256 << 20;
+// a client stalling for this long, mid-message or before it, is dropped
+// so that it does not hold up later requests
+constexpr timeval clientTimeout{10, 0};
+// bound on the emitted files kept for repeated requests, in bytes
+constexpr size_t outputsCapacity = 64 << 20;
+
+struct Socket {
+  int fd;
+  explicit Socket(int fd) : fd(fd) {}
+  Socket(const Socket &) = delete;
+  Socket &operator=(const Socket &) = delete;
+  ~Socket() {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+};
+
+bool address(const std::string &path, sockaddr_un &addr) {
+  addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    LOG_ERROR("socket path too long: {}", path);
+    return false;
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+bool readAll(int fd, char *data, size_t n) {
+  while (n) {
+    auto r = ::read(fd, data, n);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    data += r;
+    n -= r;
+  }
+  return true;
+}
+bool writeAll(int fd, const char *data, size_t n) {
+  while (n) {
+    // a client gone away must not raise SIGPIPE in the server
+    auto r = ::send(fd, data, n, MSG_NOSIGNAL);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    data += r;
+    n -= r;
+  }
+  return true;
+}
+
+void putU32(std::string &out, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    out += static_cast<char>(v >> (8 * i));
+  }
+}
+bool readU32(int fd, uint32_t &v) {
+  unsigned char bytes[4];
+  if (!readAll(fd, reinterpret_cast<char *>(bytes), sizeof(bytes))) {
+    return false;
+  }
+  v = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | uint32_t(bytes[3]) << 24;
+  return true;
+}
+
+// in one write, so that small messages go out in one segment
+bool writeMessage(int fd, const std::vector<std::string_view> &fields) {
+  std::string out;
+  putU32(out, fields.size());
+  for (auto i : fields) {
+    putU32(out, i.size());
+    out += i;
+  }
+  return writeAll(fd, out.data(), out.size());
+}
+bool readMessage(int fd, std::vector<std::string> &fields) {
+  uint32_t n;
+  if (!readU32(fd, n) || n > maxFields) {
+    return false;
+  }
+  fields.resize(n);
+  size_t total = 0;
+  for (auto &i : fields) {
+    uint32_t size;
+    if (!readU32(fd, size) || size > maxMessage - total) {
+      return false;
+    }
+    total += size;
+    i.resize(size);
+    if (!readAll(fd, i.data(), size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<std::string> split(std::string_view list) {
+  std::vector<std::string> items;
+  while (!list.empty()) {
+    auto comma = list.find(',');
+    items.emplace_back(list.substr(0, comma));
+    list.remove_prefix(comma == list.npos ? list.size() : comma + 1);
+  }
+  return items;
+}
+
+Response failure(std::string message) {
+  return {false, std::move(message) + "\n"};
+}
+} // namespace
+
+struct Server::Options {
+  FileType emit = FileType::IR;
+  unsigned optLevel = 0;
+  bool run = false;
+  std::vector<std::string> batch;
+  std::vector<std::string> exports;
+  std::string input;
+};
+
+Server::Server() {
+  initializeNativeTarget();
+  tm = createTargetMachine();
+}
+Server::~Server() = default;
+
+bool Server::serve(const std::string &path) {
+  sockaddr_un addr;
+  if (!address(path, addr)) {
+    return false;
+  }
+  Socket listener(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (listener.fd < 0) {
+    LOG_ERROR("socket: {}", std::strerror(errno));
+    return false;
+  }
+  ::unlink(path.c_str());
+  // no connection is accepted before listen, so chmod leaves no window
+  if (::bind(listener.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ||
+      ::chmod(path.c_str(), 0600) || ::listen(listener.fd, SOMAXCONN)) {
+    LOG_ERROR("{}: {}", path, std::strerror(errno));
+    return false;
+  }
+  LOG_INFO("serving on {}", path);
+  for (;;) {
+    Socket client(::accept4(listener.fd, nullptr, nullptr, SOCK_CLOEXEC));
+    if (client.fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      LOG_ERROR("accept: {}", std::strerror(errno));
+      return false;
+    }
+    ::setsockopt(client.fd, SOL_SOCKET, SO_RCVTIMEO, &clientTimeout,
+                 sizeof(clientTimeout));
+    ::setsockopt(client.fd, SOL_SOCKET, SO_SNDTIMEO, &clientTimeout,
+                 sizeof(clientTimeout));
+    std::vector<std::string> fields;
+    if (!readMessage(client.fd, fields) || fields.empty()) {
+      LOG_WARN("dropping a malformed request");
+      continue;
+    }
+    Request request;
+    request.source = std::move(fields.back());
+    fields.pop_back();
+    request.options = std::move(fields);
+    auto response = handle(request);
+    if (!writeMessage(client.fd,
+                      {response.ok ? "ok" : "error", response.output})) {
+      LOG_WARN("client left before the response");
+    }
+  }
+}
+
+Response Server::handle(const Request &request) {
+  Options options;
+  for (std::string_view i : request.options) {
+    if (i == "--run") {
+      options.run = true;
+    } else if (i == "--whole-program") {
+      options.exports.push_back("main");
+    } else if (i.starts_with("--emit=")) {
+      auto name = i.substr(7);
+      auto it = std::find(std::begin(fileTypeNames), std::end(fileTypeNames),
+                          name);
+      if (it == std::end(fileTypeNames)) {
+        return failure(std::format("unknown output kind: {}", name));
+      }
+      options.emit = static_cast<FileType>(it - std::begin(fileTypeNames));
+    } else if (i.starts_with("-O")) {
+      auto digits = i.substr(2);
+      auto [end, ec] = std::from_chars(
+          digits.data(), digits.data() + digits.size(), options.optLevel);
+      if (ec != std::errc() || end != digits.data() + digits.size() ||
+          options.optLevel > 3) {
+        return failure(std::format("bad optimization level: {}", i));
+      }
+    } else if (i.starts_with("--batch=")) {
+      options.batch = split(i.substr(8));
+    } else if (i.starts_with("--export=")) {
+      options.exports = split(i.substr(9));
+    } else if (i.starts_with("--input=")) {
+      options.input = i.substr(8);
+    } else {
+      return failure(std::format("unknown option: {}", i));
+    }
+  }
+  if (options.input.empty()) {
+    return options.run ? run(options, request.source)
+                       : emit(options, request.source);
+  }
+  std::ifstream file(options.input, std::ios::binary);
+  if (!file.good()) {
+    return failure(std::format("cannot read {}", options.input));
+  }
+  std::stringstream source;
+  source << file.rdbuf();
+  return options.run ? run(options, source.str())
+                     : emit(options, source.str());
+}
+
+Response Server::emit(const Options &options, const std::string &source) {
+  auto key = std::format("{};O{}", static_cast<int>(options.emit),
+                         options.optLevel);
+  for (auto &i : options.batch) {
+    key += std::format(",{}", i);
+  }
+  for (auto &i : options.exports) {
+    key += std::format(";{}", i);
+  }
+  key += '\n';
+  key += source;
+  if (auto it = outputs.find(key); it != outputs.end()) {
+    return {true, it->second};
+  }
+
+  ModuleAST module;
+  if (isSerializedAST(source) ? !deserializeAST(source, module)
+                              : !parseProgram(source, module)) {
+    return failure("syntax errors, see the server log");
+  }
+  if (!options.exports.empty()) {
+    auto roots = options.exports;
+    roots.insert(roots.end(), options.batch.begin(), options.batch.end());
+    if (!module.internalize(roots)) {
+      return failure("unknown exported function");
+    }
+  }
+  LLVMInit("toy");
+  if (tm) {
+    TheModule->setDataLayout(tm->createDataLayout());
+    TheModule->setTargetTriple(tm->getTargetTriple().str());
+  }
+  if (!module.codegen()) {
+    return failure("codegen errors, see the server log");
+  }
+  for (auto &i : options.batch) {
+    if (!module.codegenBatch(i)) {
+      return failure(std::format("cannot emit a batch kernel for {}", i));
+    }
+  }
+  finishProfile(*TheModule);
+  finishReport(*TheModule);
+  optimizeModule(*TheModule, tm.get(), options.optLevel);
+  llvm::SmallVector<char, 0> buffer;
+  llvm::raw_svector_ostream out(buffer);
+  if (!emitModule(*TheModule, options.emit, out, tm.get())) {
+    return failure("cannot emit the module, see the server log");
+  }
+  std::string output(buffer.begin(), buffer.end());
+  if (outputsSize + key.size() + output.size() > outputsCapacity) {
+    outputs.clear();
+    outputsSize = 0;
+  }
+  outputsSize += key.size() + output.size();
+  outputs[std::move(key)] = output;
+  return {true, std::move(output)};
+}
+
+Response Server::run(const Options &options, const std::string &source) {
+  engine.setOptLevel(options.optLevel);
+  engine.setExports(options.exports);
+  auto program = engine.compile(source, options.batch);
+  if (!program) {
+    return failure("compile errors, see the server log");
+  }
+  auto mainD = program->signature("main") == "d"
+                   ? program->lookup<double()>("main")
+                   : nullptr;
+  auto mainI = program->lookup<int64_t()>("main");
+  if (!mainD && !mainI) {
+    return failure("no main() to run");
+  }
+
+  // the child sends what main() printed and exits, without atexit handlers
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds)) {
+    return failure(std::format("socketpair: {}", std::strerror(errno)));
+  }
+  Socket reader(fds[0]);
+  pid_t pid;
+  {
+    Socket writer(fds[1]);
+    pid = ::fork();
+    if (pid == 0) {
+      std::string output;
+      capturePrint(&output);
+      if (mainD) {
+        mainD();
+      } else {
+        mainI();
+      }
+      capturePrint(nullptr);
+      ::_exit(writeAll(writer.fd, output.data(), output.size()) ? 0 : 1);
+    }
+  }
+  if (pid < 0) {
+    return failure(std::format("fork: {}", std::strerror(errno)));
+  }
+
+  Response response{true, {}};
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(runTimeout);
+  bool timedOut = false;
+  for (;;) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now())
+                    .count();
+    pollfd ready{reader.fd, POLLIN, 0};
+    auto r = left > 0 ? ::poll(&ready, 1, left) : 0;
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r == 0) {
+      timedOut = true;
+      break;
+    }
+    char buffer[4096];
+    auto n = ::read(reader.fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    response.output.append(buffer, n);
+  }
+  if (timedOut) {
+    ::kill(pid, SIGKILL);
+  }
+  int status = 0;
+  while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  if (timedOut) {
+    response.ok = false;
+    response.output +=
+        std::format("main() still running after {} s, killed\n", runTimeout);
+  } else if (WIFSIGNALED(status)) {
+    response.ok = false;
+    response.output += std::format("main() killed by signal {} ({})\n",
+                                   WTERMSIG(status),
+                                   ::strsignal(WTERMSIG(status)));
+  } else if (WEXITSTATUS(status)) {
+    response.ok = false;
+    response.output += "main() output lost\n";
+  }
+  return response;
+}
+
+bool sendRequest(const std::string &path, const Request &request,
+                 Response &response) {
+  sockaddr_un addr;
+  if (!address(path, addr)) {
+    return false;
+  }
+  Socket server(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (server.fd < 0 ||
+      ::connect(server.fd, reinterpret_cast<sockaddr *>(&addr),
+                sizeof(addr))) {
+    LOG_ERROR("{}: {}", path, std::strerror(errno));
+    return false;
+  }
+  std::vector<std::string_view> fields(request.options.begin(),
+                                       request.options.end());
+  fields.push_back(request.source);
+  std::vector<std::string> reply;
+  if (!writeMessage(server.fd, fields) || !readMessage(server.fd, reply) ||
+      reply.size() != 2) {
+    LOG_ERROR("{}: the server broke off the request", path);
+    return false;
+  }
+  response.ok = reply[0] == "ok";
+  response.output = std::move(reply[1]);
+  return true;
+}
+} // namespace Toy
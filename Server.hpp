@@ -0,0 +1,72 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+#include "Engine.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Toy {
+// A program and the driver options to compile it with: --emit=<kind>,
+// -O<n>, --run, --batch=<names>, --export=<names>, --whole-program, and
+// --input=<file> for a source the server reads itself.
+//
+// On the socket, a message is a count of strings, then each string as its
+// length and bytes, counts and lengths 32-bit little-endian. A request is
+// its options followed by the source; a response is "ok" or "error"
+// followed by the output.
+struct Request {
+  std::vector<std::string> options;
+  std::string source;
+};
+struct Response {
+  bool ok = false;
+  // the emitted file, what main() printed for --run, or the error
+  std::string output;
+};
+
+// toyd: the compiler resident on a Unix domain socket. Requests skip
+// process startup and LLVM initialization, share one target machine, and
+// hit the JIT cache and the emitted files of earlier requests. Options not
+// carried by requests (--fp-model and the like) are the server's own.
+// Requests are served one at a time, as codegen goes through the global
+// module, and a client that stalls mid-message is dropped after a timeout.
+// The socket is only open to the server's user, as requests read files
+// with its permissions.
+//
+// main() of a --run request runs in a forked child, so that a trap or a
+// stack overflow fails the request instead of the server, and a program
+// still running after runTimeout is killed. Profile counters and reports
+// of the child are not written.
+class Server {
+public:
+  Server();
+  ~Server();
+
+  // Accept requests on path until an error, which is logged. A stale
+  // socket file at path is replaced.
+  bool serve(const std::string &path);
+  Response handle(const Request &request);
+
+  static constexpr unsigned runTimeout = 10; // seconds
+
+private:
+  struct Options;
+  Response emit(const Options &options, const std::string &source);
+  Response run(const Options &options, const std::string &source);
+
+  std::unique_ptr<llvm::TargetMachine> tm;
+  Engine engine;
+  // emitted files by options and source, dropped together when full
+  std::unordered_map<std::string, std::string> outputs;
+  size_t outputsSize = 0;
+};
+
+// Send request to the server listening on path. False if the server
+// cannot be reached or the exchange breaks off, which is logged.
+bool sendRequest(const std::string &path, const Request &request,
+                 Response &response);
+} // namespace Toy
+
+#endif // SERVER_HPP
@@ -0,0 +1,195 @@
+#include "AST.hpp"
+
+#include <bit>
+#include <map>
+#include <optional>
+
+namespace Toy {
+namespace {
+// copies keep the source line of the original, for debug info
+template <typename T>
+std::unique_ptr<ExprAST> withLine(const ExprAST &from, std::unique_ptr<T> to) {
+  to->setLine(from.getLine());
+  return to;
+}
+} // namespace
+
+std::unique_ptr<ExprAST> NumberExprAST::clone() const {
+  return std::make_unique<NumberExprAST>(*this);
+}
+std::unique_ptr<ExprAST> IntegerExprAST::clone() const {
+  return std::make_unique<IntegerExprAST>(*this);
+}
+std::unique_ptr<ExprAST> VariableExprAST::clone() const {
+  return std::make_unique<VariableExprAST>(*this);
+}
+std::unique_ptr<ExprAST> BinaryExprAST::clone() const {
+  return withLine(*this, std::make_unique<BinaryExprAST>(
+                             opcode, lhs->clone().release(),
+                             rhs->clone().release()));
+}
+std::unique_ptr<ExprAST> CallExprAST::clone() const {
+  std::vector<std::unique_ptr<ExprAST>> args;
+  for (auto &i : arguments) {
+    args.push_back(i->clone());
+  }
+  return withLine(*this, std::make_unique<CallExprAST>(callee, args));
+}
+std::unique_ptr<ExprAST> PrototypeAST::clone() const {
+  return std::make_unique<PrototypeAST>(*this);
+}
+std::unique_ptr<ExprAST> FunctionAST::clone() const {
+  return std::make_unique<FunctionAST>(new PrototypeAST(*proto),
+                                       body->clone().release());
+}
+std::unique_ptr<ExprAST> IfElseExprAST::clone() const {
+  return withLine(*this, std::make_unique<IfElseExprAST>(
+                             condition->clone().release(),
+                             then->clone().release(),
+                             else_->clone().release()));
+}
+std::unique_ptr<ExprAST> BlockExprAST::clone() const {
+  std::vector<std::unique_ptr<ExprAST>> copy;
+  for (auto &i : exprs) {
+    copy.push_back(i->clone());
+  }
+  return withLine(*this, std::make_unique<BlockExprAST>(copy));
+}
+std::unique_ptr<ExprAST> VarExprAST::clone() const {
+  return withLine(*this,
+                  std::make_unique<VarExprAST>(var, init->clone().release()));
+}
+std::unique_ptr<ExprAST> AssignExprAST::clone() const {
+  return withLine(*this, std::make_unique<AssignExprAST>(
+                             name, value->clone().release()));
+}
+std::unique_ptr<ExprAST> WhileExprAST::clone() const {
+  return withLine(*this, std::make_unique<WhileExprAST>(
+                             condition->clone().release(),
+                             body->clone().release()));
+}
+std::unique_ptr<ExprAST> ForExprAST::clone() const {
+  return withLine(*this,
+                  std::make_unique<ForExprAST>(
+                      var.name, start->clone().release(),
+                      condition->clone().release(),
+                      step ? step->clone().release() : nullptr,
+                      body->clone().release()));
+}
+std::unique_ptr<ExprAST> IndexExprAST::clone() const {
+  return withLine(*this, std::make_unique<IndexExprAST>(
+                             name, index->clone().release(),
+                             value ? value->clone().release() : nullptr));
+}
+std::unique_ptr<ExprAST> ParExprAST::clone() const {
+  return withLine(*this,
+                  std::make_unique<ParExprAST>(expr->clone().release()));
+}
+
+namespace {
+// literal arguments by parameter position: their kind, as 1.0 and the
+// integer with the same bits are different arguments, and their bits
+using Literal = std::pair<Type, int64_t>;
+using Pattern = std::map<size_t, Literal>;
+
+std::optional<Literal> literal(ExprAST &e) {
+  if (auto n = dynamic_cast<NumberExprAST *>(&e)) {
+    return Literal{Type::Double, std::bit_cast<int64_t>(n->getValue())};
+  }
+  if (auto i = dynamic_cast<IntegerExprAST *>(&e)) {
+    return Literal{Type::Int, i->getValue()};
+  }
+  return std::nullopt;
+}
+
+size_t size(ExprAST &e) {
+  size_t n = 0;
+  e.walk([&](ExprAST &) { n++; });
+  return n;
+}
+} // namespace
+
+void ModuleAST::specialize() {
+  if (specializeGrowth == 0) {
+    return;
+  }
+  std::unordered_map<std::string, FunctionAST *> definitions;
+  size_t total = 0;
+  for (auto &i : functions) {
+    definitions[i->getProto().getName()] = i.get();
+    total += size(*i);
+  }
+  auto budget = total * specializeGrowth / 100;
+  std::map<std::pair<std::string, Pattern>, std::string> clones;
+
+  // clones are appended, and specialized in turn
+  for (size_t f = 0; f < functions.size(); f++) {
+    std::vector<CallExprAST *> calls;
+    functions[f]->walk([&](ExprAST &e) {
+      if (auto call = dynamic_cast<CallExprAST *>(&e)) {
+        calls.push_back(call);
+      }
+    });
+    for (auto call : calls) {
+      auto it = definitions.find(call->getCallee());
+      if (it == definitions.end()) {
+        continue;
+      }
+      auto &callee = *it->second;
+      auto &params = callee.getProto().getArguments();
+      auto &args = call->getArguments();
+      if (params.size() != args.size()) {
+        continue;
+      }
+      Pattern pattern;
+      for (size_t i = 0; i < args.size(); i++) {
+        auto value = literal(*args[i]);
+        if (value && params[i].type != Type::Array) {
+          pattern[i] = *value;
+        }
+      }
+      if (pattern.empty()) {
+        continue;
+      }
+      auto key = std::make_pair(call->getCallee(), pattern);
+      auto clone = clones.find(key);
+      if (clone == clones.end()) {
+        auto cost = size(callee);
+        if (cost > budget) {
+          continue;
+        }
+        budget -= cost;
+        // the literals become bindings of the clone, typed as the
+        // parameters, so the body folds them after mem2reg
+        std::vector<Parameter> kept;
+        std::vector<std::unique_ptr<ExprAST>> body;
+        for (size_t i = 0; i < params.size(); i++) {
+          if (!pattern.contains(i)) {
+            kept.push_back(params[i]);
+            continue;
+          }
+          body.push_back(std::make_unique<VarExprAST>(
+              Parameter{params[i].name, params[i].type, true},
+              args[i]->clone().release()));
+        }
+        body.push_back(callee.getBody().clone());
+        auto name = std::format("{}.spec{}", call->getCallee(), clones.size());
+        auto proto = new PrototypeAST(name, std::move(kept),
+                                      callee.getProto().getReturnType());
+        proto->setAttributes(callee.getProto().getAttributes());
+        proto->setInternal();
+        proto->finalizeTypes();
+        auto func = new FunctionAST(proto, new BlockExprAST(body));
+        addFunction(func);
+        definitions[name] = func;
+        clone = clones.emplace(key, name).first;
+      }
+      // drop the literal arguments, back to front
+      for (auto i = pattern.rbegin(); i != pattern.rend(); ++i) {
+        args.erase(args.begin() + i->first);
+      }
+      call->setCallee(clone->second);
+    }
+  }
+}
+} // namespace Toy
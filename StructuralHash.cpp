@@ -0,0 +1,174 @@
+#include "StructuralHash.hpp"
+#include "AST.hpp"
+
+#include <bit>
+
+namespace Toy {
+void StructuralHash::add(int64_t value) {
+  key.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+void StructuralHash::add(double value) {
+  add(std::bit_cast<int64_t>(value));
+}
+void StructuralHash::add(const std::string &str) {
+  add(static_cast<int64_t>(str.size()));
+  key += str;
+}
+void StructuralHash::defineFunction(const std::string &name) {
+  if (!functions.try_emplace(name, functions.size()).second) {
+    // redefinition, which codegen rejects: never match a valid program
+    add('!');
+  }
+}
+void StructuralHash::callee(const std::string &name) {
+  auto it = functions.find(name);
+  if (it == functions.end()) {
+    add('e');
+    add(name);
+    return;
+  }
+  add('u');
+  add(it->second);
+}
+void StructuralHash::reference(const std::string &name) {
+  for (auto i = scope.size(); i-- > 0;) {
+    if (scope[i] == name) {
+      add('l');
+      add(static_cast<int64_t>(i));
+      return;
+    }
+  }
+  // unbound, codegen reports it
+  add('g');
+  add(name);
+}
+
+void NumberExprAST::hash(StructuralHash &h) const {
+  h.add('n');
+  h.add(value);
+}
+void IntegerExprAST::hash(StructuralHash &h) const {
+  h.add('i');
+  h.add(value);
+}
+void VariableExprAST::hash(StructuralHash &h) const { h.reference(name); }
+void BinaryExprAST::hash(StructuralHash &h) const {
+  h.add('b');
+  h.add(static_cast<char>(opcode));
+  lhs->hash(h);
+  rhs->hash(h);
+}
+void CallExprAST::hash(StructuralHash &h) const {
+  h.add('c');
+  h.callee(callee);
+  h.add(static_cast<int64_t>(arguments.size()));
+  for (auto &i : arguments) {
+    i->hash(h);
+  }
+}
+void PrototypeAST::hash(StructuralHash &h) const {
+  h.add('p');
+  h.add(static_cast<int64_t>(arguments.size()));
+  for (auto &i : arguments) {
+    h.add(static_cast<char>(i.annotated ? i.type : Type::Unknown));
+    h.bind(i.name);
+  }
+  h.add(static_cast<char>(ret.annotated ? ret.type : Type::Unknown));
+  h.add(internal ? 'l' : 'x');
+  h.add(static_cast<int64_t>(attributes.size()));
+  for (auto &i : attributes) {
+    h.add(i);
+  }
+}
+void FunctionAST::hash(StructuralHash &h) const {
+  h.add('F');
+  auto mark = h.enterScope();
+  proto->hash(h);
+  body->hash(h);
+  h.leaveScope(mark);
+}
+void IfElseExprAST::hash(StructuralHash &h) const {
+  h.add('?');
+  condition->hash(h);
+  then->hash(h);
+  else_->hash(h);
+}
+void BlockExprAST::hash(StructuralHash &h) const {
+  h.add('{');
+  auto mark = h.enterScope();
+  for (auto &i : exprs) {
+    i->hash(h);
+  }
+  h.leaveScope(mark);
+  h.add('}');
+}
+void VarExprAST::hash(StructuralHash &h) const {
+  h.add('v');
+  h.add(static_cast<char>(var.annotated ? var.type : Type::Unknown));
+  init->hash(h);
+  h.bind(var.name);
+}
+void AssignExprAST::hash(StructuralHash &h) const {
+  h.add('=');
+  h.reference(name);
+  value->hash(h);
+}
+void WhileExprAST::hash(StructuralHash &h) const {
+  h.add('w');
+  condition->hash(h);
+  body->hash(h);
+}
+void ForExprAST::hash(StructuralHash &h) const {
+  h.add('r');
+  start->hash(h);
+  auto mark = h.enterScope();
+  h.bind(var.name);
+  condition->hash(h);
+  if (step) {
+    step->hash(h);
+  } else {
+    h.add('1');
+  }
+  body->hash(h);
+  h.leaveScope(mark);
+}
+void IndexExprAST::hash(StructuralHash &h) const {
+  h.add('[');
+  h.reference(name);
+  index->hash(h);
+  if (value) {
+    h.add('=');
+    value->hash(h);
+  }
+  h.add(']');
+}
+void ParExprAST::hash(StructuralHash &h) const {
+  h.add('|');
+  expr->hash(h);
+}
+
+void ModuleAST::hash(StructuralHash &h) const {
+  for (auto &i : functions) {
+    h.defineFunction(i->getProto().getName());
+  }
+  for (auto &i : externs) {
+    // externs bind host symbols, so their names are significant
+    h.add('E');
+    h.add(i->getName());
+    // the parameters are only in scope of the prototype
+    auto mark = h.enterScope();
+    i->hash(h);
+    h.leaveScope(mark);
+  }
+  for (auto &i : functions) {
+    i->hash(h);
+  }
+}
+std::vector<std::string> ModuleAST::getFunctionNames() const {
+  std::vector<std::string> names;
+  for (auto &i : functions) {
+    names.push_back(i->getProto().getName());
+  }
+  return names;
+}
+} // namespace Toy
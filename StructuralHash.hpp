@@ -0,0 +1,40 @@
+#ifndef STRUCTURAL_HASH_HPP
+#define STRUCTURAL_HASH_HPP
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Toy {
+// Canonical encoding of a program's structure. Bindings are numbered by
+// their position in scope and user functions by definition order, so
+// programs that only differ in the names they pick, like `def f(a) a*2`
+// and `def g(b) b*2`, encode to the same key.
+class StructuralHash {
+public:
+  void add(char tag) { key += tag; }
+  void add(int64_t value);
+  void add(double value);
+  void add(const std::string &str);
+
+  // number a user function, before any body refers to it
+  void defineFunction(const std::string &name);
+  // a call target: user functions by number, externs by name
+  void callee(const std::string &name);
+  // introduce a binding, visible until the enclosing scope is left
+  void bind(const std::string &name) { scope.push_back(name); }
+  // a use of a binding, by its position in scope
+  void reference(const std::string &name);
+  size_t enterScope() const { return scope.size(); }
+  void leaveScope(size_t mark) { scope.resize(mark); }
+
+  const std::string &getKey() const { return key; }
+
+private:
+  std::string key;
+  std::vector<std::string> scope;
+  std::unordered_map<std::string, int64_t> functions;
+};
+} // namespace Toy
+
+#endif // STRUCTURAL_HASH_HPP
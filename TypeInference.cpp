@@ -0,0 +1,179 @@
+#include "AST.hpp"
+
+namespace Toy {
+Type NumberExprAST::inferType(TypeContext &) { return Type::Double; }
+Type IntegerExprAST::inferType(TypeContext &) { return Type::Int; }
+Type VariableExprAST::inferType(TypeContext &ctx) {
+  auto it = ctx.locals.find(name);
+  return it == ctx.locals.end() || !it->second ? Type::Unknown
+                                               : it->second->type;
+}
+Type BinaryExprAST::inferType(TypeContext &ctx) {
+  auto l = lhs->inferType(ctx);
+  auto r = rhs->inferType(ctx);
+  ctx.arrayAsNumber |= l == Type::Array || r == Type::Array;
+  type = join(l, r);
+  switch (opcode) {
+  case OpType::ADD:
+  case OpType::SUB:
+  case OpType::MUL:
+  case OpType::DIV:
+    return type;
+  default:
+    // comparisons yield 0 or 1
+    return Type::Int;
+  }
+}
+Type CallExprAST::inferType(TypeContext &ctx) {
+  auto proto = ctx.module.getPrototype(callee);
+  if (!proto && (callee == "len" || mathArity(callee))) {
+    for (auto &i : arguments) {
+      i->inferType(ctx);
+    }
+    return callee == "len" ? Type::Int : Type::Double;
+  }
+  if (!proto && callee == "print" && arguments.size() == 1) {
+    // comparisons print as integers
+    return join(arguments[0]->inferType(ctx), Type::Int);
+  }
+  for (size_t i = 0; i < arguments.size(); i++) {
+    auto type = arguments[i]->inferType(ctx);
+    if (proto && i < proto->getArguments().size()) {
+      ctx.changed |= proto->refineArgument(i, type);
+    }
+  }
+  return proto ? proto->getReturnType() : Type::Unknown;
+}
+Type PrototypeAST::inferType(TypeContext &) { return ret.type; }
+Type FunctionAST::inferType(TypeContext &ctx) {
+  ctx.locals.clear();
+  for (auto &i : proto->getArguments()) {
+    ctx.locals[i.name] = &i;
+  }
+  auto type = body->inferType(ctx);
+  ctx.changed |= proto->refineReturn(type);
+  return proto->getReturnType();
+}
+Type IfElseExprAST::inferType(TypeContext &ctx) {
+  ctx.arrayAsNumber |= condition->inferType(ctx) == Type::Array;
+  auto t = then->inferType(ctx);
+  auto e = else_->inferType(ctx);
+  ctx.arrayAsNumber |= t != e && (t == Type::Array || e == Type::Array) &&
+                       t != Type::Unknown && e != Type::Unknown;
+  return join(t, e);
+}
+
+Type BlockExprAST::inferType(TypeContext &ctx) {
+  auto scope = ctx.locals;
+  auto type = Type::Unknown;
+  for (auto &i : exprs) {
+    type = i->inferType(ctx);
+  }
+  ctx.locals = std::move(scope);
+  return type;
+}
+Type VarExprAST::inferType(TypeContext &ctx) {
+  ctx.changed |= refine(var, init->inferType(ctx));
+  ctx.locals[var.name] = &var;
+  return var.type;
+}
+Type AssignExprAST::inferType(TypeContext &ctx) {
+  auto type = value->inferType(ctx);
+  auto it = ctx.locals.find(name);
+  if (it == ctx.locals.end() || !it->second) {
+    return type;
+  }
+  ctx.changed |= refine(*it->second, type);
+  return it->second->type;
+}
+Type WhileExprAST::inferType(TypeContext &ctx) {
+  ctx.arrayAsNumber |= condition->inferType(ctx) == Type::Array;
+  body->inferType(ctx);
+  return Type::Int;
+}
+Type ForExprAST::inferType(TypeContext &ctx) {
+  ctx.changed |= refine(var, start->inferType(ctx));
+  auto shadowed = ctx.locals[var.name];
+  ctx.locals[var.name] = &var;
+  ctx.arrayAsNumber |= condition->inferType(ctx) == Type::Array;
+  body->inferType(ctx);
+  ctx.changed |= refine(var, step ? step->inferType(ctx) : Type::Int);
+  ctx.locals[var.name] = shadowed;
+  return Type::Int;
+}
+Type IndexExprAST::inferType(TypeContext &ctx) {
+  index->inferType(ctx);
+  if (value) {
+    value->inferType(ctx);
+  }
+  return Type::Double;
+}
+Type ParExprAST::inferType(TypeContext &ctx) { return expr->inferType(ctx); }
+
+bool refine(Parameter &binding, Type type) {
+  if (binding.annotated || join(binding.type, type) == binding.type) {
+    return false;
+  }
+  binding.type = join(binding.type, type);
+  return true;
+}
+bool PrototypeAST::refineArgument(size_t i, Type type) {
+  return refine(arguments[i], type);
+}
+bool PrototypeAST::refineReturn(Type type) { return refine(ret, type); }
+bool PrototypeAST::defaultArguments() {
+  bool changed = false;
+  for (auto &i : arguments) {
+    if (i.type == Type::Unknown) {
+      i.type = Type::Double;
+      changed = true;
+    }
+  }
+  return changed;
+}
+void PrototypeAST::finalizeTypes() {
+  for (auto &i : arguments) {
+    if (i.type == Type::Unknown) {
+      i.type = Type::Double;
+    }
+    i.annotated = true;
+  }
+  if (ret.type == Type::Unknown) {
+    ret.type = Type::Double;
+  }
+  ret.annotated = true;
+}
+
+bool ModuleAST::inferTypes() {
+  // externs follow the host ABI: unannotated means double
+  for (auto &i : externs) {
+    i->finalizeTypes();
+  }
+  TypeContext ctx{*this};
+  while (true) {
+    do {
+      ctx.changed = false;
+      for (auto &i : functions) {
+        i->inferType(ctx);
+      }
+    } while (ctx.changed);
+    // parameters no call site constrains are doubles, which may in turn
+    // widen return types, so iterate again
+    bool defaulted = false;
+    for (auto &i : functions) {
+      defaulted |= i->getProto().defaultArguments();
+    }
+    if (!defaulted) {
+      break;
+    }
+  }
+  for (auto &i : functions) {
+    i->getProto().finalizeTypes();
+  }
+  if (ctx.arrayAsNumber) {
+    LOG_ERROR("array used as a number");
+    return false;
+  }
+  return true;
+}
+} // namespace Toy
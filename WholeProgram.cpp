@@ -0,0 +1,53 @@
+#include "AST.hpp"
+
+#include <unordered_set>
+
+namespace Toy {
+bool ModuleAST::internalize(const std::vector<std::string> &exports) {
+  std::unordered_map<std::string, FunctionAST *> definitions;
+  for (auto &i : functions) {
+    definitions[i->getProto().getName()] = i.get();
+  }
+  std::vector<std::string> work;
+  for (auto &i : exports) {
+    if (!definitions.contains(i)) {
+      LOG_ERROR("cannot export {}, it is not defined", i);
+      return false;
+    }
+    work.push_back(i);
+  }
+  std::unordered_set<std::string> live;
+  while (!work.empty()) {
+    auto name = std::move(work.back());
+    work.pop_back();
+    auto it = definitions.find(name);
+    if (!live.insert(name).second || it == definitions.end()) {
+      continue;
+    }
+    it->second->walk([&](ExprAST &e) {
+      if (auto call = dynamic_cast<CallExprAST *>(&e)) {
+        work.push_back(call->getCallee());
+      }
+    });
+  }
+
+  auto dead = [&](const std::string &name) { return !live.contains(name); };
+  std::erase_if(functions,
+                [&](auto &i) { return dead(i->getProto().getName()); });
+  std::erase_if(externs, [&](auto &i) { return dead(i->getName()); });
+  prototypes.clear();
+  for (auto &i : externs) {
+    if (!i->isMathBuiltin()) {
+      prototypes.try_emplace(i->getName(), i.get());
+    }
+  }
+  for (auto &i : functions) {
+    prototypes[i->getProto().getName()] = &i->getProto();
+    if (std::find(exports.begin(), exports.end(), i->getProto().getName()) ==
+        exports.end()) {
+      i->getProto().setInternal();
+    }
+  }
+  return true;
+}
+} // namespace Toy
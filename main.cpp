@@ -1,36 +1,585 @@
+#include "Emit.hpp"
+#include "Engine.hpp"
+#include "Optimizer.hpp"
+#include "Parallel.hpp"
+#include "Parse.hpp"
+#include "Profile.hpp"
+#include "Report.hpp"
+#include "Runtime.hpp"
 #include "Scanner.hpp"
+#include "Server.hpp"
 #include "toy.tab.hpp"
 #include <Logger.hpp>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
 
+#include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Transforms/IPO/Internalize.h>
 
-std::unique_ptr<llvm::LLVMContext> TheContext;
-std::unique_ptr<llvm::IRBuilder<>> Builder;
-std::unique_ptr<llvm::Module> TheModule;
-std::unordered_map<std::string, llvm::Value *> NamedValues;
+static llvm::cl::list<std::string> InputFilenames(
+    llvm::cl::Positional,
+    llvm::cl::desc("<input files, or @file listing them>"));
+// Streaming covers the expression language only: arithmetic, comparisons,
+// if/else and calls to externs or functions defined above. var, blocks,
+// loops, arrays and par are rejected with an error, @attributes on
+// definitions do not parse, and unannotated parameters are doubles rather
+// than inferred from call sites.
+static llvm::cl::opt<bool>
+    Stream("stream",
+           llvm::cl::desc("Emit IR from the parser actions without building "
+                          "an AST (one-shot compiles)"));
+static llvm::cl::list<std::string>
+    Batch("batch",
+          llvm::cl::desc("Also emit <name>_batch(const double **cols, "
+                         "double *out, size_t n) kernels for these functions"),
+          llvm::cl::CommaSeparated);
+static llvm::cl::opt<unsigned> OptLevel("O",
+                                        llvm::cl::desc("Optimization level"),
+                                        llvm::cl::Prefix, llvm::cl::init(0));
+static llvm::cl::opt<Toy::IfElseExprAST::Strategy> IfConversion(
+    "if-conversion",
+    llvm::cl::desc("Lowering of if/else whose arms have no side effects"),
+    llvm::cl::values(
+        clEnumValN(Toy::IfElseExprAST::Strategy::Auto, "auto",
+                   "Select when both arms are cheap (default)"),
+        clEnumValN(Toy::IfElseExprAST::Strategy::Select, "select",
+                   "Always select"),
+        clEnumValN(Toy::IfElseExprAST::Strategy::Branch, "branch",
+                   "Always branch")),
+    llvm::cl::init(Toy::IfElseExprAST::Strategy::Auto));
+static llvm::cl::opt<Toy::PrototypeAST::FPModel> FPModel(
+    "fp-model", llvm::cl::desc("Floating-point semantics of arithmetic"),
+    llvm::cl::values(
+        clEnumValN(Toy::PrototypeAST::FPModel::Strict, "strict",
+                   "IEEE results (default)"),
+        clEnumValN(Toy::PrototypeAST::FPModel::Contract, "contract",
+                   "Fuse multiply-add"),
+        clEnumValN(Toy::PrototypeAST::FPModel::Fast, "fast",
+                   "Reassociate, fuse, assume finite values")),
+    llvm::cl::init(Toy::PrototypeAST::FPModel::Strict));
+static llvm::cl::opt<llvm::TargetLibraryInfoImpl::VectorLibrary>
+    VectorLibrary(
+        "vector-library",
+        llvm::cl::desc("Vector math library for vectorized math builtins"),
+        llvm::cl::values(
+            clEnumValN(llvm::TargetLibraryInfoImpl::NoLibrary, "none",
+                       "No vector library (default)"),
+            clEnumValN(llvm::TargetLibraryInfoImpl::LIBMVEC_X86, "libmvec",
+                       "GLIBC vector math library"),
+            clEnumValN(llvm::TargetLibraryInfoImpl::SVML, "svml",
+                       "Intel SVML"),
+            clEnumValN(llvm::TargetLibraryInfoImpl::SLEEFGNUABI, "sleef",
+                       "SLEEF"),
+            clEnumValN(llvm::TargetLibraryInfoImpl::Accelerate, "accelerate",
+                       "Apple Accelerate")),
+        llvm::cl::init(llvm::TargetLibraryInfoImpl::NoLibrary));
+static llvm::cl::opt<unsigned> ParCutoff(
+    "par-cutoff",
+    llvm::cl::desc("par() runs calls in order once <n> tasks are queued "
+                   "(default 0, twice the hardware threads)"),
+    llvm::cl::value_desc("n"), llvm::cl::init(0));
+static llvm::cl::opt<bool>
+    AutoMemo("auto-memo",
+             llvm::cl::desc("Memoize pure functions that call themselves "
+                            "more than once, besides those marked @memo"));
+static llvm::cl::opt<bool>
+    MemoStats("memo-stats",
+              llvm::cl::desc("Print hit rates of memo tables after --run"));
+static llvm::cl::opt<unsigned> Specialize(
+    "specialize",
+    llvm::cl::desc("Clone functions called with literal arguments, growing "
+                   "the program by at most <percent> (default 0, off)"),
+    llvm::cl::value_desc("percent"), llvm::cl::init(0));
+static llvm::cl::opt<bool> WholeProgram(
+    "whole-program",
+    llvm::cl::desc("Drop functions main() cannot reach and make the rest "
+                   "internal"));
+static llvm::cl::list<std::string>
+    Export("export",
+           llvm::cl::desc("Whole-program mode exporting these functions "
+                          "instead of main()"),
+           llvm::cl::CommaSeparated);
+static llvm::cl::opt<Toy::FileType> Emit(
+    "emit", llvm::cl::desc("Kind of output"),
+    llvm::cl::values(
+        clEnumValN(Toy::FileType::None, "none",
+                   "Nothing, to only compile or time it"),
+        clEnumValN(Toy::FileType::Bitcode, "bc",
+                   "LLVM bitcode, which later runs take as input"),
+        clEnumValN(Toy::FileType::IR, "ll", "Textual LLVM IR (default)"),
+        clEnumValN(Toy::FileType::Assembly, "asm", "Assembly"),
+        clEnumValN(Toy::FileType::Object, "obj", "Object file")),
+    llvm::cl::init(Toy::FileType::IR));
+static llvm::cl::opt<std::string> OutputFilename(
+    "o",
+    llvm::cl::desc("Output file (default stdout), or the directory for "
+                   "outputs of several inputs (default next to each input)"),
+    llvm::cl::value_desc("file"), llvm::cl::init("-"));
+static llvm::cl::opt<bool>
+    Link("link", llvm::cl::desc("Link the inputs into one program, optimized "
+                                "as a whole, and write it to -o"));
+static llvm::cl::opt<std::string> EmitAST(
+    "emit-ast",
+    llvm::cl::desc("Write the parsed program to <file> in binary form, "
+                   "which later runs take as input instead of source"),
+    llvm::cl::value_desc("file"));
+static llvm::cl::opt<bool> Run("run",
+                               llvm::cl::desc("JIT compile and run main()"));
+static llvm::cl::opt<bool>
+    Perf("perf", llvm::cl::desc("With --run, tell perf about JIT'd functions "
+                                "through /tmp/perf-<pid>.map and jitdump"));
+static llvm::cl::opt<bool>
+    DebugInfo("g", llvm::cl::desc("Emit line tables for functions, "
+                                  "statements and calls"));
+static llvm::cl::opt<bool>
+    Verbose("v", llvm::cl::desc("Log debug output, such as the AST of each "
+                                "function before its codegen"));
+static llvm::cl::opt<std::string>
+    Serve("serve",
+          llvm::cl::desc("Run as the toyd compile server on the Unix domain "
+                         "socket <path>, with the other options as defaults"),
+          llvm::cl::value_desc("path"));
+static llvm::cl::opt<std::string> Connect(
+    "connect",
+    llvm::cl::desc("Have the server on <path> compile or --run the input"),
+    llvm::cl::value_desc("path"));
+static llvm::cl::opt<std::string> ProfileGenerate(
+    "profile-generate",
+    llvm::cl::desc("Count function entries and if/else arms, writing the "
+                   "profile to <file> at exit"),
+    llvm::cl::value_desc("file"));
+static llvm::cl::opt<Toy::ReportMode> ProfileReport(
+    "profile-report",
+    llvm::cl::desc("Report time spent per function at exit"),
+    llvm::cl::values(
+        clEnumValN(Toy::ReportMode::Instrument, "instrument",
+                   "Count calls and inclusive/exclusive cycles in every "
+                   "function"),
+        clEnumValN(Toy::ReportMode::Sample, "sample",
+                   "Sample the running function every millisecond of CPU "
+                   "time, with --run")),
+    llvm::cl::init(Toy::ReportMode::Off));
+static llvm::cl::opt<std::string> ProfileReportFile(
+    "profile-report-file",
+    llvm::cl::desc("Write the --profile-report to <file> as JSON instead "
+                   "of a table on stderr"),
+    llvm::cl::value_desc("file"));
+static llvm::cl::opt<std::string>
+    ProfileUse("profile-use",
+               llvm::cl::desc("Optimize with the profile in <file>"),
+               llvm::cl::value_desc("file"));
 
-void LLVMInit(const std::string &module_name) {
-  TheContext = std::make_unique<llvm::LLVMContext>();
-  TheModule = std::make_unique<llvm::Module>(module_name, *TheContext);
-  Builder = std::make_unique<llvm::IRBuilder<>>(*TheContext);
+// functions visible outside the module, empty if not in whole-program mode
+static std::vector<std::string> exports() {
+  if (!Export.empty()) {
+    return Export;
+  }
+  if (WholeProgram) {
+    return {"main"};
+  }
+  return {};
 }
 
-int main(int argc, char *argv[]) {
-  Toy::Logger::instance().setLogLevel(Toy::LogLevel::DEBUG);
-  if (argc != 2) {
+// the first bytes of the input, to tell serialized forms from source
+static std::string head(std::ifstream &file) {
+  std::string bytes(16, '\0');
+  file.read(bytes.data(), bytes.size());
+  bytes.resize(file.gcount());
+  file.clear();
+  file.seekg(0);
+  return bytes;
+}
+
+static bool parse(std::ifstream &file, Toy::ModuleAST &module) {
+  std::stringstream source;
+  source << file.rdbuf();
+  return Toy::parseProgram(source.str(), module);
+}
+
+// a fresh module on this thread, for the host target
+static void init(const std::string &name, llvm::TargetMachine *tm) {
+  LLVMInit(name);
+  if (tm) {
+    TheModule->setDataLayout(tm->createDataLayout());
+    TheModule->setTargetTriple(tm->getTargetTriple().str());
+  }
+}
+
+// one per thread, as emitting code through a TargetMachine is not
+// thread-safe
+static llvm::TargetMachine *targetMachine() {
+  thread_local auto tm = Toy::createTargetMachine();
+  return tm.get();
+}
+
+// the codegen settings of this thread, which are thread_local
+static void configure() {
+  Toy::IfElseExprAST::strategy = IfConversion;
+  Toy::PrototypeAST::fpModel = FPModel;
+  Toy::ParExprAST::cutoff = ParCutoff;
+  Toy::ModuleAST::autoMemo = AutoMemo;
+  Toy::ModuleAST::specializeGrowth = Specialize;
+  Toy::ModuleAST::debugInfo = DebugInfo;
+}
+
+// The front end for one input, onto a fresh module of this thread. The
+// input is source, --emit-ast output, or bitcode compiled already. Parts
+// of a --link program leave whole-program mode until after the link, and
+// only get the batch kernels of functions they define.
+static bool frontEnd(const std::string &input) {
+  std::ifstream file(input, std::ios::binary);
+  if (!file.good()) {
+    LOG_ERROR("cannot read {}", input);
+    return false;
+  }
+  configure();
+  init(input, targetMachine());
+  auto start = head(file);
+  if (llvm::isBitcode(reinterpret_cast<const unsigned char *>(start.data()),
+                      reinterpret_cast<const unsigned char *>(
+                          start.data() + start.size()))) {
+    // compiled already, --emit=bc output
+    if (!Link && (!Batch.empty() || !exports().empty())) {
+      LOG_ERROR("bitcode input is compiled already");
+      return false;
+    }
+    return (TheModule = Toy::readModule(input, *TheContext)) != nullptr;
+  }
+  Toy::ModuleAST module;
+  if (Toy::isSerializedAST(start) ? !Toy::readAST(input, module)
+                                  : !parse(file, module)) {
+    return false;
+  }
+  std::vector<std::string> batch = Batch;
+  if (Link) {
+    auto names = module.getFunctionNames();
+    std::erase_if(batch, [&](const std::string &i) {
+      return std::find(names.begin(), names.end(), i) == names.end();
+    });
+  } else if (auto roots = exports(); !roots.empty()) {
+    roots.insert(roots.end(), Batch.begin(), Batch.end());
+    if (!module.internalize(roots)) {
+      return false;
+    }
+  }
+  if (!module.codegen()) {
+    return false;
+  }
+  for (auto &i : batch) {
+    if (!module.codegenBatch(i)) {
+      LOG_ERROR("cannot emit a batch kernel");
+      return false;
+    }
+  }
+  Toy::finishProfile(*TheModule);
+  Toy::finishReport(*TheModule);
+  return true;
+}
+
+// Compile one input ahead of time into output, on the calling thread's
+// module.
+static bool compile(const std::string &input, const std::string &output) {
+  if (!frontEnd(input)) {
+    return false;
+  }
+  Toy::optimizeModule(*TheModule, targetMachine(), OptLevel);
+  return Toy::emitModule(*TheModule, Emit, output, targetMachine());
+}
+
+// --link: the inputs compiled concurrently to bitcode, as contexts are per
+// thread, then linked into one module for the post-link pipeline
+static int link() {
+  auto n = InputFilenames.size();
+  std::vector<llvm::SmallVector<char, 0>> parts(n);
+  std::vector<char> ok(n);
+  Toy::parallelFor(n, [&](size_t i) {
+    if (!frontEnd(InputFilenames[i])) {
+      return;
+    }
+    Toy::optimizeModule(*TheModule, targetMachine(), OptLevel,
+                        Toy::LTOPhase::PreLink);
+    llvm::raw_svector_ostream out(parts[i]);
+    ok[i] = Toy::emitModule(*TheModule, Toy::FileType::Bitcode, out,
+                            targetMachine());
+  });
+  if (std::find(ok.begin(), ok.end(), false) != ok.end()) {
+    return -1;
+  }
+
+  auto tm = targetMachine();
+  init("program", tm);
+  std::vector<std::unique_ptr<llvm::Module>> modules;
+  std::unordered_map<std::string, llvm::FunctionType *> definitions;
+  for (size_t i = 0; i < n; i++) {
+    auto module = llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef(llvm::StringRef(parts[i].data(), parts[i].size()),
+                              InputFilenames[i]),
+        *TheContext);
+    if (!module) {
+      LOG_ERROR("{}", llvm::toString(module.takeError()));
+      return -1;
+    }
+    for (auto &func : **module) {
+      if (!func.isDeclaration() && !func.hasLocalLinkage()) {
+        definitions[func.getName().str()] = func.getFunctionType();
+      }
+    }
+    modules.push_back(std::move(*module));
+  }
+  // the linker does not check an extern against the definition it binds to
+  for (size_t i = 0; i < n; i++) {
+    for (auto &func : *modules[i]) {
+      auto it = definitions.find(func.getName().str());
+      if (func.isDeclaration() && it != definitions.end() &&
+          it->second != func.getFunctionType()) {
+        LOG_ERROR("{}: {} does not have the types of its definition, "
+                  "annotate them",
+                  InputFilenames[i], func.getName().str());
+        return -1;
+      }
+    }
+  }
+  for (auto &i : modules) {
+    if (llvm::Linker::linkModules(*TheModule, std::move(i))) {
+      return -1;
+    }
+  }
+  for (auto &i : Batch) {
+    if (!TheModule->getFunction(i + "_batch")) {
+      LOG_ERROR("cannot emit a batch kernel");
+      return -1;
+    }
+  }
+  if (auto roots = exports(); !roots.empty()) {
+    for (auto &i : Batch) {
+      roots.push_back(i + "_batch");
+    }
+    for (auto &i : roots) {
+      if (!TheModule->getFunction(i)) {
+        LOG_ERROR("Unknown function referenced");
+        return -1;
+      }
+    }
+    llvm::internalizeModule(*TheModule, [&](const llvm::GlobalValue &gv) {
+      return std::find(roots.begin(), roots.end(), gv.getName()) != roots.end();
+    });
+  }
+  Toy::optimizeModule(*TheModule, tm, OptLevel, Toy::LTOPhase::PostLink);
+  return Toy::emitModule(*TheModule, Emit, OutputFilename, tm) ? 0 : -1;
+}
+
+// Several inputs: compiled concurrently, each into <stem>.<kind> next to it
+// or in the -o directory, with a status line per input and the totals.
+static int compileAll() {
+  static const char *const extensions[] = {"", ".bc", ".ll", ".s", ".o"};
+  auto extension = extensions[static_cast<int>(Emit.getValue())];
+  struct Result {
+    bool ok;
+    double ms;
+  };
+  using Clock = std::chrono::steady_clock;
+  auto ms = [](Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+  std::vector<Result> results(InputFilenames.size());
+  auto begin = Clock::now();
+  Toy::parallelFor(InputFilenames.size(), [&](size_t i) {
+    std::filesystem::path input(InputFilenames[i]);
+    auto output = input;
+    if (OutputFilename != "-") {
+      output = std::filesystem::path(OutputFilename.getValue()) /
+               input.filename();
+    }
+    output.replace_extension(extension);
+    auto start = Clock::now();
+    bool ok = compile(input.string(), output.string());
+    results[i] = {ok, ms(Clock::now() - start)};
+  });
+  auto wall = ms(Clock::now() - begin);
+  size_t failed = 0;
+  double total = 0;
+  for (size_t i = 0; i < results.size(); i++) {
+    failed += !results[i].ok;
+    total += results[i].ms;
+    std::cerr << std::format("{} {} {:.1f} ms\n",
+                             results[i].ok ? "ok" : "FAILED",
+                             InputFilenames[i], results[i].ms);
+  }
+  std::cerr << std::format("{} files, {} failed, {:.1f} ms ({:.1f} ms "
+                           "compiling)\n",
+                           results.size(), failed, wall, total);
+  return failed ? -1 : 0;
+}
+
+static int run(std::ifstream &file) {
+  std::stringstream source;
+  source << file.rdbuf();
+  Toy::Engine engine(Perf);
+  engine.setOptLevel(OptLevel);
+  engine.setExports(exports());
+  // for sources declaring `extern print(x)`
+  engine.define("print", toy_print_double);
+  auto program = engine.compile(source.str(), Batch);
+  if (!program) {
     return -1;
   }
-  std::ifstream file(argv[1]);
-  if (!file.good() && file.eof()) {
+  if (ProfileReport == Toy::ReportMode::Sample &&
+      !Toy::startSampling(ProfileReportFile)) {
     return -1;
   }
-  LLVMInit(argv[1]);
-  auto scanner = std::make_unique<Toy::Scanner>(&file);
-  auto parser = std::make_unique<Toy::Parser>(*scanner);
-  parser->parse();
-  TheModule->print(llvm::outs(), nullptr);
+  if (program->signature("main") == "d") {
+    program->lookup<double()>("main")();
+  } else if (auto main = program->lookup<int64_t()>("main")) {
+    main();
+  } else {
+    return -1;
+  }
+  toy_print_flush();
+  if (MemoStats) {
+    for (auto &i : Toy::memoStats()) {
+      auto calls = i.hits + i.misses;
+      std::cerr << std::format("{}: {} calls, {:.1f}% hits\n", i.name, calls,
+                               calls ? 100.0 * i.hits / calls : 0.0);
+    }
+  }
   return 0;
-}
\ No newline at end of file
+}
+
+// --connect: the options a server request carries, the rest are the
+// server's
+static int request(std::ifstream &file) {
+  Toy::Request request;
+  request.options.push_back(std::format("-O{}", unsigned(OptLevel)));
+  request.options.push_back(std::format(
+      "--emit={}", Toy::fileTypeNames[static_cast<int>(Emit.getValue())]));
+  if (Run) {
+    request.options.push_back("--run");
+  }
+  auto join = [](const std::vector<std::string> &names) {
+    std::string list;
+    for (auto &i : names) {
+      list += (list.empty() ? "" : ",") + i;
+    }
+    return list;
+  };
+  if (!Batch.empty()) {
+    request.options.push_back("--batch=" + join(Batch));
+  }
+  if (auto roots = exports(); !roots.empty()) {
+    request.options.push_back("--export=" + join(roots));
+  }
+  std::stringstream source;
+  source << file.rdbuf();
+  request.source = source.str();
+  Toy::Response response;
+  if (!Toy::sendRequest(Connect, request, response)) {
+    return -1;
+  }
+  if (!response.ok) {
+    std::cerr << response.output;
+    return -1;
+  }
+  if (Run || OutputFilename == "-") {
+    std::cout << response.output << std::flush;
+    return 0;
+  }
+  std::ofstream out(OutputFilename, std::ios::binary);
+  out << response.output;
+  if (!out.good()) {
+    LOG_ERROR("cannot write {}", std::string(OutputFilename));
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  llvm::cl::ParseCommandLineOptions(argc, argv, "Toy compiler\n");
+  if (Verbose) {
+    Toy::Logger::instance().setLogLevel(Toy::LogLevel::DEBUG);
+  }
+  // once, before parallelFor workers create their target machines
+  Toy::initializeNativeTarget();
+  if (Serve.empty() && InputFilenames.empty()) {
+    LOG_ERROR("no input file");
+    return -1;
+  }
+  std::ifstream file(Serve.empty() ? InputFilenames.front() : "");
+  if (Serve.empty() && !file.good()) {
+    return -1;
+  }
+  if (!Connect.empty()) {
+    return request(file);
+  }
+  configure();
+  Toy::setVectorLibrary(VectorLibrary);
+  Toy::setProfileGenerate(ProfileGenerate);
+  Toy::setReport(ProfileReport, ProfileReportFile);
+  if (!ProfileUse.empty()) {
+    Toy::ProfileData profile;
+    if (!Toy::readProfile(ProfileUse, profile)) {
+      return -1;
+    }
+    Toy::setProfileUse(std::move(profile));
+  }
+  if (!Serve.empty()) {
+    Toy::Server server;
+    return server.serve(Serve) ? 0 : -1;
+  }
+  if (Run) {
+    if (Link || InputFilenames.size() > 1) {
+      LOG_ERROR("--run takes one input");
+      return -1;
+    }
+    return run(file);
+  }
+  if (Link || InputFilenames.size() > 1) {
+    if (Stream || !EmitAST.empty()) {
+      LOG_ERROR("--stream and --emit-ast take one input");
+      return -1;
+    }
+    return Link ? link() : compileAll();
+  }
+  auto &input = InputFilenames.front();
+  if (!Stream && EmitAST.empty()) {
+    return compile(input, OutputFilename) ? 0 : -1;
+  }
+  Toy::ModuleAST module;
+  if (!EmitAST.empty()) {
+    if (Stream) {
+      LOG_ERROR("--emit-ast needs the AST");
+      return -1;
+    }
+    if (Toy::isSerializedAST(head(file)) ? !Toy::readAST(input, module)
+                                         : !parse(file, module)) {
+      return -1;
+    }
+    return Toy::writeAST(EmitAST, module) ? 0 : -1;
+  }
+  if (!exports().empty()) {
+    LOG_ERROR("whole-program mode needs the AST");
+    return -1;
+  }
+  if (!Batch.empty()) {
+    LOG_ERROR("cannot emit a batch kernel");
+    return -1;
+  }
+  auto tm = Toy::createTargetMachine();
+  init(input, tm.get());
+  auto scanner = std::make_unique<Toy::Scanner>(&file, Stream);
+  auto parser = std::make_unique<Toy::Parser>(*scanner, module);
+  if (parser->parse() != 0) {
+    return -1;
+  }
+  Toy::finishProfile(*TheModule);
+  Toy::finishReport(*TheModule);
+  Toy::optimizeModule(*TheModule, tm.get(), OptLevel);
+  return Toy::emitModule(*TheModule, Emit, OutputFilename, tm.get()) ? 0 : -1;
+}
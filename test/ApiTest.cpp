@@ -0,0 +1,58 @@
+#include "Check.hpp"
+#include "Engine.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace {
+double offset(double x) { return x + 0.5; }
+} // namespace
+
+int main() {
+  Toy::Engine engine;
+  engine.define("offset", offset);
+  auto program = engine.compile(R"(
+extern offset(x)
+def f(x) { offset(x) * 2 }
+def next(n: int) { n + 1 }
+)");
+  CHECK(program);
+  CHECK(program->signature("f") == "dd");
+  CHECK(program->signature("next") == "ii");
+  CHECK(program->signature("offset").empty());
+  CHECK(program->signature("missing").empty());
+
+  // handles only come with the function's own signature
+  CHECK(!program->lookup<int64_t(int64_t)>("f"));
+  CHECK(!program->lookup<double(double, double)>("f"));
+  CHECK(!program->lookup<double(double)>("next"));
+  CHECK(!program->lookup<double(double)>("missing"));
+  auto f = program->lookup<double(double)>("f");
+  auto next = program->lookup<int64_t(int64_t)>("next");
+  CHECK(f && f(1) == 3);
+  CHECK(next && next(41) == 42);
+
+  // compiled once, called from any thread
+  std::atomic<int> wrong = 0;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 10000; i++) {
+        wrong += f(t + i) != 2 * (t + i + 0.5);
+      }
+    });
+  }
+  for (auto &i : threads) {
+    i.join();
+  }
+  CHECK(wrong == 0);
+
+  // errors give no program, and leave the engine usable
+  CHECK(!engine.compile("def f(x) { x +"));
+  CHECK(!engine.compile("def f(x) { undefined(x) }"));
+  auto again = engine.compile("def g(x) { x - 1 }");
+  CHECK(again && again->lookup<double(double)>("g")(1) == 0);
+  return 0;
+}
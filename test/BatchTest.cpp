@@ -0,0 +1,72 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Engine.hpp"
+#include "Optimizer.hpp"
+#include "Parse.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace {
+const char *source = R"(
+def poly(x, y) { x * y + 1 }
+def clamp(x) { if x < 0 { 0.0 } else { x } }
+def scaled(n: int, x) { n * x }
+)";
+using Kernel = void(const double **, double *, int64_t);
+} // namespace
+
+int main() {
+  Toy::Engine engine;
+  auto program = engine.compile(source, {"poly", "clamp", "scaled"});
+  CHECK(program);
+  auto poly = program->lookup<Kernel>("poly_batch");
+  auto clamp = program->lookup<Kernel>("clamp_batch");
+  auto scaled = program->lookup<Kernel>("scaled_batch");
+  CHECK(poly && clamp && scaled);
+  auto scalarPoly = program->lookup<double(double, double)>("poly");
+  CHECK(scalarPoly);
+
+  // odd sizes leave a remainder after any vector loop
+  for (int64_t n : {0, 1, 7, 100, 1001}) {
+    std::vector<double> x(n), y(n), out(n, -1);
+    for (int64_t i = 0; i < n; i++) {
+      x[i] = i * 0.5 - 20;
+      y[i] = 3 - i * 0.25;
+    }
+    const double *cols[] = {x.data(), y.data()};
+    poly(cols, out.data(), n);
+    for (int64_t i = 0; i < n; i++) {
+      CHECK(out[i] == scalarPoly(x[i], y[i]));
+    }
+    clamp(cols, out.data(), n);
+    for (int64_t i = 0; i < n; i++) {
+      CHECK(out[i] == (x[i] < 0 ? 0 : x[i]));
+    }
+  }
+  // integer parameters take their columns converted, as a call would
+  double n[] = {2.7, -3.5}, x[] = {1.5, 2};
+  const double *cols[] = {n, x};
+  double out[2];
+  scaled(cols, out, 2);
+  CHECK(out[0] == 3 && out[1] == -6);
+
+  // the kernel's loop is one the vectorizer takes
+  Toy::initializeNativeTarget();
+  auto tm = Toy::createTargetMachine();
+  LLVMInit("batch");
+  TheModule->setDataLayout(tm->createDataLayout());
+  TheModule->setTargetTriple(tm->getTargetTriple().str());
+  Toy::ModuleAST module;
+  CHECK(Toy::parseProgram(source, module));
+  CHECK(module.codegen() && module.codegenBatch("poly"));
+  Toy::optimizeModule(*TheModule, tm.get(), 2);
+  bool vector = false;
+  for (auto &bb : *TheModule->getFunction("poly_batch")) {
+    for (auto &inst : bb) {
+      vector |= inst.getType()->isVectorTy();
+    }
+  }
+  CHECK(vector);
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Engine.hpp"
+#include "Parse.hpp"
+
+#include <cstdint>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+const char *source = R"(
+def at(a: double[], i: int) { a[i] }
+def sum(a: double[]) {
+  var s = 0.0;
+  for i = 0, i < len(a) { s = s + a[i] };
+  s
+}
+def strided(a: double[]) {
+  var s = 0.0;
+  for i = 1, i < len(a), 2 { s = s + a[i] };
+  s
+}
+def leaps(a: double[]) {
+  var s = 0.0;
+  for i = 0, i < len(a), 9223372036854775807 { s = s + a[i] };
+  s
+}
+def shifted(a: double[]) {
+  var s = 0.0;
+  for i = 0, i < len(a) { s = s + a[i + 1] };
+  s
+}
+)";
+
+using At = double(double *, int64_t, int64_t);
+
+// whether at(a, i) dies of a signal rather than returning
+bool traps(At *at, double *a, int64_t n, int64_t i) {
+  auto pid = fork();
+  if (pid == 0) {
+    _exit(at(a, n, i) == a[i] ? 0 : 1);
+  }
+  int status;
+  return waitpid(pid, &status, 0) == pid && WIFSIGNALED(status);
+}
+
+// whether the IR of name has a bounds check before optimization
+bool checked(const char *name) {
+  auto func = TheModule->getFunction(name);
+  for (auto &bb : *func) {
+    if (bb.getName().starts_with("bounds.fail")) {
+      return true;
+    }
+  }
+  return false;
+}
+} // namespace
+
+int main() {
+  Toy::Engine engine;
+  auto program = engine.compile(source);
+  CHECK(program);
+  double a[] = {1, 2, 3, 4, 5};
+  auto at = program->lookup<At>("at");
+  CHECK(at && at(a, 5, 2) == 3);
+  CHECK(!traps(at, a, 5, 4));
+  CHECK(traps(at, a, 5, 5));
+  CHECK(traps(at, a, 5, -1));
+  auto sum = program->lookup<double(double *, int64_t)>("sum");
+  CHECK(sum && sum(a, 5) == 15);
+  auto strided = program->lookup<double(double *, int64_t)>("strided");
+  CHECK(strided && strided(a, 5) == 6);
+
+  // only the loops proven to stay within len(a) lose their checks
+  LLVMInit("bounds");
+  Toy::ModuleAST module;
+  CHECK(Toy::parseProgram(source, module));
+  CHECK(module.codegen());
+  CHECK(checked("at"));
+  CHECK(!checked("sum"));
+  CHECK(!checked("strided"));
+  CHECK(checked("leaps"));
+  CHECK(checked("shifted"));
+  return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef CHECK_HPP
+#define CHECK_HPP
+#include <cstdio>
+
+// A failed check is reported with its line and fails the test, as main()
+// returns 1.
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,    \
+                   #cond);                                                     \
+      return 1;                                                                \
+    }                                                                          \
+  } while (0)
+
+#endif // CHECK_HPP
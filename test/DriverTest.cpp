@@ -0,0 +1,90 @@
+#include "Check.hpp"
+
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+
+// Runs the compiler, whose path is the only argument, on files in a
+// scratch directory.
+namespace {
+std::string toy;
+std::string dir;
+
+void write(const std::string &name, const std::string &text) {
+  std::ofstream(dir + "/" + name) << text;
+}
+std::string read(const std::string &name) {
+  std::ifstream in(dir + "/" + name);
+  std::stringstream text;
+  text << in.rdbuf();
+  return text.str();
+}
+bool exists(const std::string &name) {
+  return std::ifstream(dir + "/" + name).good();
+}
+bool contains(const std::string &text, const std::string &part) {
+  return text.find(part) != std::string::npos;
+}
+// the exit status of toy with args, in dir, stderr going to "stderr"
+int run(const std::string &args) {
+  auto status = std::system(
+      std::format("cd '{}' && '{}' {} 2>stderr", dir, toy, args).c_str());
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  CHECK(argc == 2);
+  toy = argv[1];
+  char scratch[] = "/tmp/toy-driver-test-XXXXXX";
+  CHECK(mkdtemp(scratch));
+  dir = scratch;
+
+  // several inputs compile concurrently, each to an output of its own
+  write("a.toy", "def a(x: int) { x + 1 }");
+  write("b.toy", "def b(x) { x * 2 }");
+  write("c.toy", "def c(x) { x + }");
+  std::filesystem::create_directory(dir + "/out");
+  CHECK(run("--emit=ll -o out a.toy b.toy c.toy") != 0);
+  CHECK(contains(read("out/a.ll"), "define i64 @a("));
+  CHECK(contains(read("out/b.ll"), "define double @b("));
+  CHECK(!exists("out/c.ll"));
+  auto report = read("stderr");
+  CHECK(contains(report, "ok a.toy") && contains(report, "ok b.toy"));
+  CHECK(contains(report, "FAILED c.toy"));
+  CHECK(contains(report, "3 files, 1 failed"));
+
+  // without -o the outputs go next to the inputs, here listed in a file
+  write("inputs", "a.toy\nb.toy\n");
+  CHECK(run("--emit=bc @inputs") == 0);
+  CHECK(exists("a.bc") && exists("b.bc"));
+  CHECK(contains(read("stderr"), "2 files, 0 failed"));
+
+  // --link optimizes the inputs as one program
+  write("lib.toy", "def helper(n: int) { n * 2 }\n"
+                   "def unused(n: int) { n - 1 }");
+  write("main.toy", "extern helper(n: int): int\n"
+                    "def main() { print(helper(21)) }");
+  CHECK(run("--link --whole-program -O2 --emit=ll -o program.ll main.toy "
+            "lib.toy") == 0);
+  auto program = read("program.ll");
+  CHECK(contains(program, "i64 @main("));
+  // helper is inlined across the files and gone, unused is dropped
+  CHECK(!contains(program, "@helper("));
+  CHECK(!contains(program, "@unused"));
+
+  // an extern whose types differ from the definition in another file
+  write("guess.toy", "extern helper(n)\n"
+                     "def main() { print(helper(21)) }");
+  CHECK(run("--link --emit=ll -o guess.ll guess.toy lib.toy") != 0);
+  CHECK(contains(read("stderr"), "helper does not have the types of its "
+                                 "definition"));
+  CHECK(!exists("guess.ll"));
+
+  std::filesystem::remove_all(dir);
+  return 0;
+}
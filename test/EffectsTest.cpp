@@ -0,0 +1,55 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Parse.hpp"
+
+namespace {
+const char *source = R"(
+extern unknown(x)
+@pure
+extern known(x)
+def sq(x) { x * x }
+def twice(x) { sq(x) + known(x) }
+def get(a: double[], i: int) { a[i] }
+def set(a: double[]) { a[0] = 1 }
+def show(x) { print(x) }
+def opaque(x) { unknown(x) + sq(x) }
+def countdown(n: int) { while n > 0 { n = n - 1 } }
+def fact(n: int) { if n < 2 { 1 } else { n * fact(n - 1) } }
+def quot(n: int, d: int) { n / d }
+)";
+} // namespace
+
+int main() {
+  using llvm::MemoryEffects;
+  using llvm::ModRefInfo;
+  LLVMInit("effects");
+  Toy::ModuleAST module;
+  CHECK(Toy::parseProgram(source, module));
+  CHECK(module.codegen());
+  auto fn = [](const char *name) { return TheModule->getFunction(name); };
+
+  // arithmetic, and calls of functions that are, touch no memory
+  for (auto name : {"sq", "twice"}) {
+    CHECK(fn(name)->getMemoryEffects() == MemoryEffects::none());
+    CHECK(fn(name)->doesNotThrow() && fn(name)->willReturn());
+  }
+  // arrays are argument memory, and their bounds checks may trap
+  auto trap = MemoryEffects::inaccessibleMemOnly(ModRefInfo::Mod);
+  CHECK(fn("get")->getMemoryEffects() ==
+        (MemoryEffects::argMemOnly(ModRefInfo::Ref) | trap));
+  CHECK(fn("set")->getMemoryEffects() ==
+        (MemoryEffects::argMemOnly(ModRefInfo::ModRef) | trap));
+  CHECK(!fn("get")->willReturn());
+  CHECK(fn("quot")->getMemoryEffects() == trap);
+  // print only touches the runtime's buffer
+  CHECK(fn("show")->getMemoryEffects() == MemoryEffects::inaccessibleMemOnly());
+  // nothing is known of an unannotated extern
+  CHECK(fn("opaque")->getMemoryEffects() == MemoryEffects::unknown());
+  CHECK(!fn("opaque")->doesNotThrow());
+  // loops and recursion may not terminate
+  for (auto name : {"countdown", "fact"}) {
+    CHECK(fn(name)->getMemoryEffects() == MemoryEffects::none());
+    CHECK(!fn(name)->willReturn());
+  }
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Emit.hpp"
+#include "Optimizer.hpp"
+#include "Parse.hpp"
+
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#include <llvm/BinaryFormat/Magic.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+
+namespace {
+std::unique_ptr<llvm::TargetMachine> target;
+
+// a fresh module of the program for target, as emitting code may change it
+bool build() {
+  LLVMInit("emit");
+  TheModule->setDataLayout(target->createDataLayout());
+  TheModule->setTargetTriple(target->getTargetTriple().str());
+  Toy::ModuleAST module;
+  return Toy::parseProgram("def twice(x: int) { x * 2 }", module) &&
+         module.codegen();
+}
+
+bool emit(Toy::FileType type, std::string &out) {
+  if (!build()) {
+    return false;
+  }
+  llvm::SmallVector<char, 0> buffer;
+  llvm::raw_svector_ostream stream(buffer);
+  if (!Toy::emitModule(*TheModule, type, stream, target.get())) {
+    return false;
+  }
+  out.assign(buffer.begin(), buffer.end());
+  return true;
+}
+} // namespace
+
+int main() {
+  Toy::initializeNativeTarget();
+  target = Toy::createTargetMachine();
+  CHECK(target);
+  using Toy::FileType;
+  std::string none, bitcode, ir, assembly, object;
+  CHECK(emit(FileType::None, none) && none.empty());
+  CHECK(emit(FileType::Bitcode, bitcode));
+  CHECK(llvm::identify_magic(bitcode) == llvm::file_magic::bitcode);
+  CHECK(emit(FileType::IR, ir));
+  CHECK(ir.find("define i64 @twice(i64") != std::string::npos);
+  CHECK(emit(FileType::Assembly, assembly));
+  CHECK(assembly.find("twice:") != std::string::npos);
+  CHECK(emit(FileType::Object, object));
+  auto magic = llvm::identify_magic(object);
+  CHECK(magic == llvm::file_magic::elf_relocatable ||
+        magic == llvm::file_magic::macho_object ||
+        magic == llvm::file_magic::coff_object);
+  CHECK(object.find("twice") != std::string::npos);
+
+  // bitcode and IR written to files read back for later compiles
+  auto path = "/tmp/toy-emit-test-" + std::to_string(getpid());
+  for (auto type : {FileType::Bitcode, FileType::IR}) {
+    CHECK(build());
+    CHECK(Toy::emitModule(*TheModule, type, path, target.get()));
+    llvm::LLVMContext context;
+    auto module = Toy::readModule(path, context);
+    CHECK(module && module->getFunction("twice"));
+    CHECK(!module->getFunction("twice")->isDeclaration());
+  }
+  unlink(path.c_str());
+  llvm::LLVMContext context;
+  CHECK(!Toy::readModule(path, context));
+  // --emit=none writes nothing, not even an empty file
+  CHECK(build());
+  CHECK(Toy::emitModule(*TheModule, FileType::None, path, target.get()));
+  CHECK(!std::ifstream(path).good());
+  return 0;
+}
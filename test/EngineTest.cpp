@@ -0,0 +1,36 @@
+#include "Check.hpp"
+#include "Engine.hpp"
+
+#include <cstdint>
+
+using Fn = int64_t(int64_t);
+
+int main() {
+  Toy::Engine engine;
+  auto a = engine.compile("def twice(x: int) { x * 2 }");
+  CHECK(a);
+  auto twice = a->lookup<Fn>("twice");
+  CHECK(twice && twice(21) == 42);
+
+  // the same source hits the cache, and so does one differing in names
+  auto b = engine.compile("def twice(x: int) { x * 2 }");
+  CHECK(b && b->lookup<Fn>("twice") == twice);
+  auto c = engine.compile("def dbl(y: int) { y * 2 }");
+  CHECK(c && c->lookup<Fn>("dbl") == twice);
+  CHECK(!c->lookup<Fn>("twice"));
+  auto d = engine.compile("def thrice(x: int) { x * 3 }");
+  CHECK(d);
+  auto thrice = d->lookup<Fn>("thrice");
+  CHECK(thrice && thrice != twice && thrice(2) == 6);
+
+  // evicted code is compiled again, and stays alive for its Programs
+  engine.setCacheCapacity(0);
+  auto e = engine.compile("def twice(x: int) { x * 2 }");
+  CHECK(e);
+  auto again = e->lookup<Fn>("twice");
+  CHECK(again && again != twice && again(5) == 10);
+  CHECK(twice(4) == 8);
+  auto f = engine.compile("def twice(x: int) { x * 2 }");
+  CHECK(f && f->lookup<Fn>("twice") != again);
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Engine.hpp"
+#include "Parse.hpp"
+
+#include <llvm/IR/Instructions.h>
+
+namespace {
+using FPModel = Toy::PrototypeAST::FPModel;
+
+const char *source = R"(
+def plain(a, b, c) { a * b + c }
+@contract
+def fused(a, b, c) { a * b + c }
+@fast
+def loose(a, b, c) { a * b + c }
+def cancel(x) { x + 10000000000000000.0 - 10000000000000000.0 }
+)";
+
+// flags of the additions of each function, before optimization
+bool flags(FPModel model, llvm::FastMathFlags (&out)[3]) {
+  Toy::PrototypeAST::fpModel = model;
+  LLVMInit("fp");
+  Toy::ModuleAST module;
+  if (!Toy::parseProgram(source, module) || !module.codegen()) {
+    return false;
+  }
+  const char *names[] = {"plain", "fused", "loose"};
+  for (int i = 0; i < 3; i++) {
+    for (auto &bb : *TheModule->getFunction(names[i])) {
+      for (auto &inst : bb) {
+        if (inst.getOpcode() == llvm::Instruction::FAdd) {
+          out[i] = inst.getFastMathFlags();
+        }
+      }
+    }
+  }
+  return true;
+}
+} // namespace
+
+int main() {
+  llvm::FastMathFlags strict[3];
+  CHECK(flags(FPModel::Strict, strict));
+  CHECK(strict[0].none());
+  CHECK(strict[1].allowContract() && !strict[1].allowReassoc());
+  CHECK(strict[2].isFast());
+  auto loose = TheModule->getFunction("loose");
+  auto unsafe = loose->getFnAttribute("unsafe-fp-math");
+  CHECK(unsafe.getValueAsString() == "true");
+
+  // the option sets the default, attributes only go further
+  llvm::FastMathFlags contract[3];
+  CHECK(flags(FPModel::Contract, contract));
+  CHECK(contract[0].allowContract() && !contract[0].allowReassoc());
+  CHECK(contract[1].allowContract() && !contract[1].allowReassoc());
+  CHECK(contract[2].isFast());
+  llvm::FastMathFlags fast[3];
+  CHECK(flags(FPModel::Fast, fast));
+  CHECK(fast[0].isFast() && fast[1].isFast() && fast[2].isFast());
+
+  // strict code rounds every operation, even optimized
+  Toy::PrototypeAST::fpModel = FPModel::Strict;
+  Toy::Engine engine;
+  auto program = engine.compile(source);
+  CHECK(program);
+  auto cancel = program->lookup<double(double)>("cancel");
+  CHECK(cancel && cancel(0.5) == 0);
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Engine.hpp"
+#include "Optimizer.hpp"
+#include "Parse.hpp"
+
+#include <cstdint>
+
+namespace {
+const char *source = R"(
+def sum(n: int) {
+  var s = 0;
+  for i = 1, i < n + 1 { s = s + i };
+  s
+}
+def fact(n: int) {
+  var r = 1;
+  while n > 1 { r = r * n; n = n - 1 };
+  r
+}
+def collatz(n: int) {
+  var steps = 0;
+  while n != 1 {
+    if n - n / 2 * 2 == 0 { n = n / 2 } else { n = 3 * n + 1 };
+    steps = steps + 1
+  };
+  steps
+}
+def triangle(n: int) {
+  var count = 0;
+  for i = 0, i < n {
+    for j = 0, j < i + 1 { count = count + 1 }
+  };
+  count
+}
+def shadow(x: int) {
+  var y = x;
+  for x = 0, x < 3 { y = y + x };
+  y + x
+}
+def half(x) {
+  var h = x;
+  h = h / 2
+}
+)";
+} // namespace
+
+int main() {
+  Toy::Engine engine;
+  auto program = engine.compile(source);
+  CHECK(program);
+  using Fn = int64_t(int64_t);
+  auto sum = program->lookup<Fn>("sum");
+  auto fact = program->lookup<Fn>("fact");
+  auto collatz = program->lookup<Fn>("collatz");
+  auto triangle = program->lookup<Fn>("triangle");
+  auto shadow = program->lookup<Fn>("shadow");
+  auto half = program->lookup<double(double)>("half");
+  CHECK(sum && fact && collatz && triangle && shadow && half);
+  CHECK(sum(0) == 0 && sum(100) == 5050);
+  CHECK(fact(1) == 1 && fact(10) == 3628800);
+  CHECK(collatz(1) == 0 && collatz(27) == 111);
+  CHECK(triangle(10) == 55);
+  // the loop variable shadows x only inside the loop
+  CHECK(shadow(10) == 23);
+  // assignment yields the value assigned
+  CHECK(half(5) == 2.5);
+
+  // the locals live in allocas until mem2reg, which runs even at -O0
+  Toy::initializeNativeTarget();
+  auto tm = Toy::createTargetMachine();
+  LLVMInit("loops");
+  Toy::ModuleAST module;
+  CHECK(Toy::parseProgram(source, module));
+  CHECK(module.codegen());
+  Toy::optimizeModule(*TheModule, tm.get(), 0);
+  for (auto &func : *TheModule) {
+    for (auto &bb : func) {
+      for (auto &inst : bb) {
+        CHECK(!llvm::isa<llvm::AllocaInst>(inst));
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Engine.hpp"
+#include "Optimizer.hpp"
+#include "Parse.hpp"
+#include "Runtime.hpp"
+
+#include <cstdint>
+#include <string>
+
+#include <llvm/IR/IntrinsicInst.h>
+
+namespace {
+const char *source = R"(
+def root(n: int) { sqrt(n) }
+def mix(x, y) { pow(x, y) + fma(x, y, 1) + fmin(x, y) + floor(0 - x) }
+def sign(x) { copysign(3, x) }
+def roots(a: double[]) { for i = 0, i < len(a) { a[i] = sqrt(a[i]) } }
+def show(n: int) { print(n); print(n * 0.5); print(n < 2) }
+)";
+} // namespace
+
+int main() {
+  Toy::Engine engine;
+  auto program = engine.compile(source);
+  CHECK(program);
+  auto root = program->lookup<double(int64_t)>("root");
+  auto mix = program->lookup<double(double, double)>("mix");
+  auto sign = program->lookup<double(double)>("sign");
+  auto roots = program->lookup<int64_t(double *, int64_t)>("roots");
+  auto show = program->lookup<int64_t(int64_t)>("show");
+  CHECK(root && mix && sign && roots && show);
+  CHECK(root(16) == 4);
+  CHECK(mix(2, 3) == 8 + 7 + 2 - 2);
+  CHECK(sign(-0.0) == -3 && sign(1) == 3);
+  double a[] = {1, 4, 9, 16, 25, 36, 49, 64, 81};
+  roots(a, 9);
+  for (int i = 0; i < 9; i++) {
+    CHECK(a[i] == i + 1);
+  }
+  // print() buffers, and comparisons print as integers
+  std::string printed;
+  Toy::capturePrint(&printed);
+  show(3);
+  toy_print_flush();
+  Toy::capturePrint(nullptr);
+  CHECK(printed == "3\n1.5\n0\n");
+
+  // builtins are intrinsics rather than calls of libm, which vectorize
+  Toy::initializeNativeTarget();
+  auto tm = Toy::createTargetMachine();
+  LLVMInit("math");
+  TheModule->setDataLayout(tm->createDataLayout());
+  TheModule->setTargetTriple(tm->getTargetTriple().str());
+  Toy::ModuleAST module;
+  CHECK(Toy::parseProgram(source, module));
+  CHECK(module.codegen());
+  CHECK(!TheModule->getFunction("sqrt") && !TheModule->getFunction("pow"));
+  Toy::optimizeModule(*TheModule, tm.get(), 2);
+  bool vectorSqrt = false;
+  for (auto &bb : *TheModule->getFunction("roots")) {
+    for (auto &inst : bb) {
+      auto call = llvm::dyn_cast<llvm::IntrinsicInst>(&inst);
+      vectorSqrt |= call && call->getIntrinsicID() == llvm::Intrinsic::sqrt &&
+                    call->getType()->isVectorTy();
+    }
+  }
+  CHECK(vectorSqrt);
+  return 0;
+}
@@ -0,0 +1,35 @@
+#include "Check.hpp"
+#include "Engine.hpp"
+#include "Runtime.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+int main() {
+  Toy::Engine engine;
+  auto program = engine.compile(R"(
+@memo
+def fib(n: int) {
+  if n < 2 { n } else { fib(n - 1) + fib(n - 2) }
+}
+)");
+  CHECK(program);
+  auto fib = program->lookup<int64_t(int64_t)>("fib");
+  CHECK(fib && fib(30) == 832040);
+
+  auto stats = [] {
+    auto all = Toy::memoStats();
+    auto it = std::find_if(all.begin(), all.end(),
+                           [](auto &i) { return i.name == "fib"; });
+    return it == all.end() ? Toy::MemoStats{} : *it;
+  };
+  // one miss per argument 0..30, then fib(k - 2) is known for k >= 3
+  auto first = stats();
+  CHECK(first.name == "fib");
+  CHECK(first.misses == 31);
+  CHECK(first.hits == 28);
+  CHECK(fib(30) == 832040);
+  auto second = stats();
+  CHECK(second.misses == 31 && second.hits == 29);
+  return 0;
+}
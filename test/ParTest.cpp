@@ -0,0 +1,35 @@
+#include "Check.hpp"
+#include "Engine.hpp"
+
+#include <cstdint>
+
+using Fn = int64_t(int64_t);
+
+int main() {
+  Toy::Engine engine;
+  auto program = engine.compile(R"(
+def fib(n: int) {
+  if n < 2 { n } else { fib(n - 1) + fib(n - 2) }
+}
+def sum(a: int, b: int) { a + b }
+def pfib(n: int) {
+  if n < 15 { fib(n) } else { par(pfib(n - 1) + pfib(n - 2)) }
+}
+def cfib(n: int) {
+  if n < 15 { fib(n) } else { par(sum(cfib(n - 1), cfib(n - 2))) }
+}
+)");
+  CHECK(program);
+  auto fib = program->lookup<Fn>("fib");
+  auto pfib = program->lookup<Fn>("pfib");
+  auto cfib = program->lookup<Fn>("cfib");
+  CHECK(fib && pfib && cfib);
+  // par() of operands and of arguments agrees with the serial code, on
+  // both sides of the cutoff
+  for (int64_t n = 0; n <= 27; n++) {
+    auto serial = fib(n);
+    CHECK(pfib(n) == serial);
+    CHECK(cfib(n) == serial);
+  }
+  return 0;
+}
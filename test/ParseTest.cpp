@@ -0,0 +1,61 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Parse.hpp"
+#include "Scanner.hpp"
+#include "Serialize.hpp"
+
+#include <format>
+#include <sstream>
+#include <string>
+
+#include <llvm/IR/DebugInfoMetadata.h>
+
+namespace {
+constexpr int items = 4000;
+
+// large enough to be split, five lines per item with def on the third
+std::string program(int broken = -1) {
+  std::string source;
+  for (int i = 0; i < items; i++) {
+    source += std::format("@pure\n"
+                          "extern e{0}(x)\n"
+                          "def f{0}(x: int) {{\n"
+                          "  if x < {0} {{ x * {0} }} else {{ e{0}(x) }}\n"
+                          "}}\n",
+                          i);
+    if (i == broken) {
+      source += "def (\n";
+    }
+  }
+  return source;
+}
+} // namespace
+
+int main() {
+  auto source = program();
+  std::istringstream in(source);
+  Toy::ModuleAST serial;
+  Toy::Scanner scanner(&in);
+  Toy::Parser parser(scanner, serial);
+  CHECK(parser.parse() == 0);
+  Toy::ModuleAST parallel;
+  CHECK(Toy::parseProgram(source, parallel));
+  CHECK(Toy::serializeAST(parallel) == Toy::serializeAST(serial));
+
+  // pieces count lines from where they start in the whole source
+  Toy::ModuleAST::debugInfo = true;
+  LLVMInit("parse");
+  CHECK(parallel.codegen());
+  for (int i = 0; i < items; i++) {
+    auto func = TheModule->getFunction(std::format("f{}", i));
+    CHECK(func && func->getSubprogram());
+    CHECK(func->getSubprogram()->getLine() == 5u * i + 3);
+  }
+
+  // an error in any piece fails the whole
+  for (int broken : {0, items / 2, items - 1}) {
+    Toy::ModuleAST module;
+    CHECK(!Toy::parseProgram(program(broken), module));
+  }
+  return 0;
+}
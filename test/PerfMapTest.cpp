@@ -0,0 +1,63 @@
+#include "Check.hpp"
+#include "Engine.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+struct Range {
+  uint64_t start;
+  uint64_t size;
+};
+
+// what perf reads: "address size name" in hex, by name
+std::unordered_map<std::string, Range> perfMap() {
+  std::ifstream in(std::format("/tmp/perf-{}.map", getpid()));
+  std::unordered_map<std::string, Range> map;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    Range range;
+    std::string name;
+    if (fields >> std::hex >> range.start >> range.size >> name) {
+      map[name] = range;
+    }
+  }
+  return map;
+}
+bool listed(const std::unordered_map<std::string, Range> &map,
+            const std::string &name, void *address) {
+  auto it = map.find(name);
+  return it != map.end() && it->second.size > 0 &&
+         it->second.start == reinterpret_cast<uint64_t>(address);
+}
+} // namespace
+
+int main() {
+  Toy::Engine engine(true);
+  auto a = engine.compile("def alpha(x) { x * 3 }\n"
+                          "def gamma(x) { alpha(x) + 1 }");
+  CHECK(a);
+  auto alpha = a->lookup<double(double)>("alpha");
+  auto gamma = a->lookup<double(double)>("gamma");
+  CHECK(alpha && gamma && gamma(2) == 7);
+  // perf names code by what it was compiled as, so other names get code
+  // of their own rather than sharing alpha's
+  auto b = engine.compile("def beta(y) { y * 3 }");
+  CHECK(b);
+  auto beta = b->lookup<double(double)>("beta");
+  CHECK(beta && beta != alpha && beta(2) == 6);
+
+  auto map = perfMap();
+  CHECK(listed(map, "alpha", reinterpret_cast<void *>(alpha)));
+  CHECK(listed(map, "gamma", reinterpret_cast<void *>(gamma)));
+  CHECK(listed(map, "beta", reinterpret_cast<void *>(beta)));
+  std::remove(std::format("/tmp/perf-{}.map", getpid()).c_str());
+  return 0;
+}
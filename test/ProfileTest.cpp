@@ -0,0 +1,66 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Engine.hpp"
+#include "Parse.hpp"
+#include "Profile.hpp"
+
+#include <cstdint>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/ProfDataUtils.h>
+
+namespace {
+// the arms call, so the if/else is a branch rather than a select
+const char *source = R"(
+def neg(x) { 0 - x }
+def pick(x) { if x < 0 { neg(x) } else { neg(x) * 2 } }
+)";
+} // namespace
+
+int main() {
+  auto path = "/tmp/toy-profile-test-" + std::to_string(getpid());
+  auto pid = fork();
+  if (pid == 0) {
+    // the counters are written at exit
+    Toy::setProfileGenerate(path);
+    Toy::Engine engine;
+    auto program = engine.compile(source);
+    auto pick = program ? program->lookup<double(double)>("pick") : nullptr;
+    if (!pick) {
+      std::exit(1);
+    }
+    for (int i = 0; i < 1000; i++) {
+      pick(i < 100 ? -1 : 1);
+    }
+    std::exit(0);
+  }
+  int status;
+  CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0);
+  Toy::ProfileData profile;
+  CHECK(Toy::readProfile(path, profile));
+  unlink(path.c_str());
+  CHECK((profile["pick"] == std::vector<uint64_t>{1000, 100, 900}));
+  CHECK(profile["neg"] == std::vector<uint64_t>{1000});
+
+  // compiled again with the profile, the branch carries the counts
+  Toy::setProfileUse(profile);
+  LLVMInit("profile");
+  Toy::ModuleAST module;
+  CHECK(Toy::parseProgram(source, module));
+  CHECK(module.codegen());
+  auto func = TheModule->getFunction("pick");
+  CHECK(func->getEntryCount() && func->getEntryCount()->getCount() == 1000);
+  llvm::SmallVector<uint32_t, 2> weights;
+  for (auto &bb : *func) {
+    auto br = llvm::dyn_cast<llvm::BranchInst>(bb.getTerminator());
+    if (br && br->isConditional()) {
+      CHECK(llvm::extractBranchWeights(*br, weights));
+    }
+  }
+  CHECK((weights == llvm::SmallVector<uint32_t, 2>{101, 901}));
+  return 0;
+}
@@ -0,0 +1,38 @@
+#include "Check.hpp"
+#include "Engine.hpp"
+#include "Report.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main() {
+  auto path = "/tmp/toy-report-test-" + std::to_string(getpid()) + ".json";
+  auto pid = fork();
+  if (pid == 0) {
+    // the report is written by exit, after par's workers counted calls
+    Toy::setReport(Toy::ReportMode::Instrument, path);
+    Toy::Engine engine;
+    auto program = engine.compile(R"(
+def fib(n: int) {
+  if n < 2 { n } else { par(fib(n - 1) + fib(n - 2)) }
+}
+)");
+    auto fib = program ? program->lookup<int64_t(int64_t)>("fib") : nullptr;
+    std::exit(fib && fib(15) == 610 ? 0 : 1);
+  }
+  int status;
+  CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0);
+  std::ifstream in(path);
+  std::stringstream report;
+  report << in.rdbuf();
+  unlink(path.c_str());
+  // every call on every thread is counted, 2 * fib(16) - 1
+  CHECK(report.str().find("{\"name\": \"fib\", \"calls\": 1973,") !=
+        std::string::npos);
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Engine.hpp"
+#include "Parse.hpp"
+
+#include <cstdint>
+
+namespace {
+using Strategy = Toy::IfElseExprAST::Strategy;
+
+const char *source = R"(
+def cheap(x) { if x < 0 { 0 - x } else { x } }
+def costly(x) { if x < 0 { x * x * x * x * x * x * x * x * x * x } else { x } }
+def calls(x) { if x < 0 { cheap(x) } else { x } }
+def divide(n: int, d: int) { if d == 0 { 0 } else { n / d } }
+)";
+
+struct Lowering {
+  bool select = false;
+  bool branch = false;
+};
+
+// how each if/else of the unoptimized IR came out
+bool lower(Strategy strategy, Lowering (&out)[4]) {
+  Toy::IfElseExprAST::strategy = strategy;
+  LLVMInit("select");
+  Toy::ModuleAST module;
+  if (!Toy::parseProgram(source, module) || !module.codegen()) {
+    return false;
+  }
+  const char *names[] = {"cheap", "costly", "calls", "divide"};
+  for (int i = 0; i < 4; i++) {
+    for (auto &bb : *TheModule->getFunction(names[i])) {
+      out[i].branch |= bb.getName().starts_with("then");
+      for (auto &inst : bb) {
+        out[i].select |= llvm::isa<llvm::SelectInst>(inst);
+      }
+    }
+  }
+  return true;
+}
+} // namespace
+
+int main() {
+  // Auto selects between cheap arms only, Select whenever both arms may
+  // be evaluated, Branch never
+  Lowering lowered[4];
+  CHECK(lower(Strategy::Auto, lowered));
+  CHECK(lowered[0].select && !lowered[0].branch);
+  CHECK(!lowered[1].select && lowered[1].branch);
+  CHECK(!lowered[2].select && lowered[2].branch);
+  CHECK(!lowered[3].select && lowered[3].branch);
+  Lowering selected[4];
+  CHECK(lower(Strategy::Select, selected));
+  CHECK(selected[0].select && !selected[0].branch);
+  CHECK(selected[1].select && !selected[1].branch);
+  CHECK(!selected[2].select && selected[2].branch);
+  CHECK(!selected[3].select && selected[3].branch);
+  Lowering branched[4];
+  CHECK(lower(Strategy::Branch, branched));
+  for (auto &i : branched) {
+    CHECK(!i.select && i.branch);
+  }
+
+  // and every lowering computes the same
+  for (auto strategy : {Strategy::Auto, Strategy::Select, Strategy::Branch}) {
+    Toy::IfElseExprAST::strategy = strategy;
+    Toy::Engine engine;
+    engine.setOptLevel(0);
+    auto program = engine.compile(source);
+    CHECK(program);
+    auto cheap = program->lookup<double(double)>("cheap");
+    auto costly = program->lookup<double(double)>("costly");
+    auto calls = program->lookup<double(double)>("calls");
+    auto divide = program->lookup<int64_t(int64_t, int64_t)>("divide");
+    CHECK(cheap && costly && calls && divide);
+    CHECK(cheap(-2) == 2 && cheap(3) == 3);
+    CHECK(costly(-2) == 1024 && costly(3) == 3);
+    CHECK(calls(-2) == 2 && calls(3) == 3);
+    // the division is not evaluated for a zero divisor, so does not trap
+    CHECK(divide(7, 0) == 0 && divide(7, 2) == 3);
+  }
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Parse.hpp"
+#include "Serialize.hpp"
+
+#include <string>
+
+namespace {
+// def main() (1 + (1 + ... (1 + 1))), nested depth times
+std::string nested(unsigned depth) {
+  Toy::ASTWriter w;
+  w.u32(0);
+  w.u32(1);
+  w.tag(Toy::NodeTag::Function);
+  w.tag(Toy::NodeTag::Prototype);
+  w.string("main");
+  w.u32(0);
+  w.byte(static_cast<uint8_t>(Toy::Type::Unknown));
+  w.u32(0);
+  for (unsigned i = 0; i < depth; i++) {
+    w.tag(Toy::NodeTag::Binary);
+    w.byte(static_cast<uint8_t>(Toy::BinaryExprAST::OpType::ADD));
+    w.tag(Toy::NodeTag::Integer);
+    w.i64(1);
+  }
+  w.tag(Toy::NodeTag::Integer);
+  w.i64(1);
+  return w.finish();
+}
+
+std::string hashOf(const Toy::ModuleAST &module) {
+  Toy::StructuralHash hash;
+  module.hash(hash);
+  return hash.getKey();
+}
+} // namespace
+
+int main() {
+  // every node kind
+  const char *source = R"(
+@pure
+extern cos(x)
+def scale(a: double[], n: int, k) {
+  for i = 0, i < n {
+    a[i] = a[i] * k
+  };
+  a[0]
+}
+@memo
+def fib(n: int) {
+  if n < 2 { n } else { par(fib(n - 1) + fib(n - 2)) }
+}
+def main() {
+  var total = 0.5;
+  var i: int = 0;
+  while i < 3 { total = total + cos(i) / 2; i = i + 1 };
+  print(fib(10) + total)
+}
+)";
+  Toy::ModuleAST parsed;
+  CHECK(Toy::parseProgram(source, parsed));
+  auto data = Toy::serializeAST(parsed);
+  CHECK(Toy::isSerializedAST(data));
+  CHECK(!Toy::isSerializedAST(source));
+
+  Toy::ModuleAST read;
+  CHECK(Toy::deserializeAST(data, read));
+  CHECK(Toy::serializeAST(read) == data);
+  CHECK(hashOf(read) == hashOf(parsed));
+  CHECK(read.getFunctionNames() == parsed.getFunctionNames());
+
+  // truncated data is rejected rather than read past its end
+  for (auto size : {data.size() / 2, data.size() - 1}) {
+    Toy::ModuleAST partial;
+    CHECK(!Toy::deserializeAST(std::string_view(data).substr(0, size),
+                               partial));
+  }
+
+  // a crafted file nesting far deeper than the stack holds is rejected
+  Toy::ModuleAST shallow;
+  CHECK(Toy::deserializeAST(nested(1000), shallow));
+  Toy::ModuleAST deep;
+  CHECK(!Toy::deserializeAST(nested(1 << 20), deep));
+  return 0;
+}
@@ -0,0 +1,61 @@
+#include "Check.hpp"
+#include "Server.hpp"
+
+#include <chrono>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+int main() {
+  auto path = "/tmp/toyd-test-" + std::to_string(::getpid()) + ".sock";
+  // serves until the process exits
+  std::thread([path] {
+    Toy::Server server;
+    server.serve(path);
+  }).detach();
+
+  auto send = [&](Toy::Request request, Toy::Response &response) {
+    return Toy::sendRequest(path, request, response);
+  };
+  Toy::Response response;
+  bool up = false;
+  for (int i = 0; i < 100 && !up; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    up = send({{"--emit=ll", "-O1"}, "def inc(x: int) { x + 1 }"}, response);
+  }
+  CHECK(up);
+  CHECK(response.ok);
+  CHECK(response.output.find("define") != std::string::npos);
+  struct stat info;
+  CHECK(::stat(path.c_str(), &info) == 0 && (info.st_mode & 0777) == 0600);
+
+  CHECK(send({{"--run"}, "def main() { print(6 * 7) }"}, response));
+  CHECK(response.ok && response.output == "42\n");
+
+  CHECK(send({{"--bogus"}, ""}, response));
+  CHECK(!response.ok);
+
+  // a trap fails the request, not the server
+  CHECK(send({{"--run"}, "def main() { var z = 0; 1 / z }"}, response));
+  CHECK(!response.ok);
+  CHECK(send({{"--run"}, "def main() { print(1) }"}, response));
+  CHECK(response.ok && response.output == "1\n");
+
+  // a client sending half a message is dropped, later ones are served
+  int stalled = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+  CHECK(::connect(stalled, reinterpret_cast<sockaddr *>(&addr),
+                  sizeof(addr)) == 0);
+  CHECK(::write(stalled, "\2\0", 2) == 2);
+  CHECK(send({{"--run"}, "def main() { print(2) }"}, response));
+  CHECK(response.ok && response.output == "2\n");
+  ::close(stalled);
+
+  ::unlink(path.c_str());
+  return 0;
+}
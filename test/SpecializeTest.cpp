@@ -0,0 +1,24 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Engine.hpp"
+
+int main() {
+  Toy::ModuleAST::specializeGrowth = 1000;
+  Toy::Engine engine;
+  // 4607182418800017408 has the bits of 1.0, the clones must differ
+  auto program = engine.compile(R"(
+def f(x) { x * 2 }
+def a() { f(1.0) }
+def b() { f(4607182418800017408) }
+def c() { f(1.0) }
+)");
+  CHECK(program);
+  auto a = program->lookup<double()>("a");
+  auto b = program->lookup<double()>("b");
+  auto c = program->lookup<double()>("c");
+  CHECK(a && b && c);
+  CHECK(a() == 2.0);
+  CHECK(b() == 2.0 * 4607182418800017408.0);
+  CHECK(c() == 2.0);
+  return 0;
+}
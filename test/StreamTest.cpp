@@ -0,0 +1,77 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Engine.hpp"
+#include "Optimizer.hpp"
+#include "Scanner.hpp"
+
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <sstream>
+
+namespace {
+// the subset streaming supports, with the types inference would pick
+const char *source = R"(
+extern sqrt(x)
+def sq(x: double) { x * x }
+def pick(a: double, b: double) {
+  if a < b { sq(a) } else { sq(b) + 1 }
+}
+def mix(n: int, x: double) { n / 2 + x * 3 - 1 }
+def hyp(a: double, b: double) { sqrt(sq(a) + sq(b)) }
+)";
+
+bool stream(const char *text) {
+  LLVMInit("stream");
+  std::istringstream in(text);
+  Toy::ModuleAST module;
+  Toy::Scanner scanner(&in, true);
+  Toy::Parser parser(scanner, module);
+  return parser.parse() == 0;
+}
+} // namespace
+
+int main() {
+  Toy::initializeNativeTarget();
+  CHECK(stream(source));
+  auto jit = llvm::orc::LLJITBuilder().create();
+  CHECK(jit);
+  TheModule->setDataLayout((*jit)->getDataLayout());
+  Builder.reset();
+  CHECK(!(*jit)->addIRModule(llvm::orc::ThreadSafeModule(
+      std::move(TheModule), std::move(TheContext))));
+  auto symbol = [&](const char *name) {
+    auto addr = (*jit)->lookup(name);
+    return addr ? addr->toPtr<void *>() : nullptr;
+  };
+  using DD = double(double, double);
+  using ID = double(int64_t, double);
+  auto streamedPick = reinterpret_cast<DD *>(symbol("pick"));
+  auto streamedMix = reinterpret_cast<ID *>(symbol("mix"));
+  auto streamedHyp = reinterpret_cast<DD *>(symbol("hyp"));
+  CHECK(streamedPick && streamedMix && streamedHyp);
+
+  Toy::Engine engine;
+  auto program = engine.compile(source);
+  CHECK(program);
+  auto pick = program->lookup<DD>("pick");
+  auto mix = program->lookup<ID>("mix");
+  auto hyp = program->lookup<DD>("hyp");
+  CHECK(pick && mix && hyp);
+
+  for (double a : {-2.5, 0.0, 1.0, 3.25}) {
+    for (double b : {-1.0, 0.5, 4.0}) {
+      CHECK(streamedPick(a, b) == pick(a, b));
+      CHECK(streamedHyp(a, b) == hyp(a, b));
+    }
+  }
+  for (int64_t n : {-7, 0, 5, 1000001}) {
+    CHECK(streamedMix(n, 0.5) == mix(n, 0.5));
+  }
+
+  // what only the AST path implements is rejected
+  CHECK(!stream("def f(x) { var y = x; y }"));
+  CHECK(!stream("def f(x) { x; x }"));
+  CHECK(!stream("def f(n) { while n > 0 { n = n - 1 } }"));
+  CHECK(!stream("def f(a: double[]) { a[0] }"));
+  CHECK(!stream("def f(x) { par(x + x) }"));
+  return 0;
+}
@@ -0,0 +1,56 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Engine.hpp"
+#include "Parse.hpp"
+
+#include <cstdint>
+
+#include <llvm/IR/Instructions.h>
+
+namespace {
+const char *source = R"(
+def count(n: int, acc: int) { if n == 0 { acc } else { count(n - 1, acc + 1) } }
+def down(x, acc) { if x < 1 { acc } else { down(x - 1, acc + 0.5) } }
+def sum(n: int) { if n == 0 { 0 } else { n + sum(n - 1) } }
+def notTail(n: int) { if n == 0 { 0 } else { notTail(n - 1) + 1 } }
+)";
+
+// whether name calls itself with musttail, before optimization
+bool mustTail(const char *name) {
+  auto func = TheModule->getFunction(name);
+  for (auto &bb : *func) {
+    for (auto &inst : bb) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      if (call && call->getCalledFunction() == func &&
+          call->isMustTailCall()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+} // namespace
+
+int main() {
+  LLVMInit("tail");
+  Toy::ModuleAST module;
+  CHECK(Toy::parseProgram(source, module));
+  CHECK(module.codegen());
+  CHECK(mustTail("count") && mustTail("down"));
+  CHECK(!mustTail("sum") && !mustTail("notTail"));
+
+  // ten million frames would overflow the stack; at -O0 the recursion
+  // becomes a loop, accumulating integer sums included
+  Toy::Engine engine;
+  engine.setOptLevel(0);
+  auto program = engine.compile(source);
+  CHECK(program);
+  auto count = program->lookup<int64_t(int64_t, int64_t)>("count");
+  auto down = program->lookup<double(double, double)>("down");
+  auto sum = program->lookup<int64_t(int64_t)>("sum");
+  CHECK(count && down && sum);
+  CHECK(count(10000000, 0) == 10000000);
+  CHECK(down(10000000, 0) == 5000000);
+  CHECK(sum(10000000) == 50000005000000);
+  return 0;
+}
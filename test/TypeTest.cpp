@@ -0,0 +1,52 @@
+#include "Check.hpp"
+#include "Engine.hpp"
+
+#include <cstdint>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+using Div = int64_t(int64_t, int64_t);
+
+// whether fn(a, b) dies of a signal rather than returning
+bool traps(Div *fn, int64_t a, int64_t b) {
+  auto pid = fork();
+  if (pid == 0) {
+    _exit(fn(a, b) == a / b ? 0 : 1);
+  }
+  int status;
+  return waitpid(pid, &status, 0) == pid && WIFSIGNALED(status);
+}
+} // namespace
+
+int main() {
+  Toy::Engine engine;
+  // integer literals and call sites make unannotated code integer
+  auto program = engine.compile(R"(
+def half(n) { n / 2 }
+def quot(a, b) { a / b }
+def scale(x) { x * 2 }
+def uses() { half(9) + quot(7, 2) + scale(1.5) }
+)");
+  CHECK(program);
+  CHECK(program->signature("half") == "ii");
+  CHECK(program->signature("quot") == "iii");
+  CHECK(program->signature("scale") == "dd");
+  CHECK(program->signature("uses") == "d");
+  auto half = program->lookup<int64_t(int64_t)>("half");
+  CHECK(half && half(9) == 4 && half(-9) == -4);
+
+  // sdiv traps where LLVM would leave it undefined
+  auto quot = program->lookup<Div>("quot");
+  CHECK(quot && quot(7, 2) == 3);
+  CHECK(!traps(quot, 7, 2));
+  CHECK(traps(quot, 7, 0));
+  CHECK(traps(quot, INT64_MIN, -1));
+  CHECK(!traps(quot, INT64_MIN, 1));
+
+  // literals that don't fit are rejected instead of wrapping
+  CHECK(engine.compile("def f() { 9223372036854775807 }"));
+  CHECK(!engine.compile("def f() { 9223372036854775808 }"));
+  CHECK(!engine.compile("def f() { 99999999999999999999 }"));
+  return 0;
+}
@@ -0,0 +1,53 @@
+#include "AST.hpp"
+#include "Check.hpp"
+#include "Engine.hpp"
+#include "Parse.hpp"
+
+#include <cstdint>
+
+namespace {
+const char *source = R"(
+extern unused(x)
+extern used(x)
+def helper(n: int) { n * 2 }
+def deeper(n: int) { helper(n) + 1 }
+def dead(n: int) { unused(n) + deeper(n) }
+def main() { deeper(20) + used(1) - 1 }
+)";
+} // namespace
+
+int main() {
+  // main() and what it calls survive, internal and fast to call
+  LLVMInit("whole");
+  Toy::ModuleAST module;
+  CHECK(Toy::parseProgram(source, module));
+  CHECK(module.internalize({"main"}));
+  CHECK(module.codegen());
+  CHECK(!TheModule->getFunction("dead"));
+  CHECK(!TheModule->getFunction("unused"));
+  CHECK(TheModule->getFunction("used"));
+  auto main = TheModule->getFunction("main");
+  CHECK(main && main->hasExternalLinkage());
+  CHECK(main->getCallingConv() == llvm::CallingConv::C);
+  for (auto name : {"helper", "deeper"}) {
+    auto func = TheModule->getFunction(name);
+    CHECK(func && func->hasInternalLinkage());
+    CHECK(func->getCallingConv() == llvm::CallingConv::Fast);
+  }
+
+  Toy::ModuleAST missing;
+  CHECK(Toy::parseProgram(source, missing));
+  CHECK(!missing.internalize({"nothing"}));
+
+  // the engine only hands out the exports
+  Toy::Engine engine;
+  engine.define("used", +[](double x) { return x + 1; });
+  engine.setExports({"main"});
+  auto program = engine.compile(source);
+  CHECK(program);
+  CHECK(!program->lookup<int64_t(int64_t)>("helper"));
+  CHECK(!program->lookup<int64_t(int64_t)>("dead"));
+  auto run = program->lookup<double()>("main");
+  CHECK(run && run() == 42);
+  return 0;
+}
@@ -8,6 +8,10 @@
 %define api.value.automove true
 
 %locations
+%initial-action {
+    // 分块并行解析时，行号从块在整个源码中的起始行算起
+    @$.initialize(nullptr, scanner.getFirstLine());
+}
 
 %code requires {
 #include "AST.hpp"
@@ -21,6 +25,7 @@ namespace Toy{
 }
 
 %parse-param {Toy::Scanner  &scanner}
+%parse-param {Toy::ModuleAST &module}
 
 %code {
     #include "Scanner.hpp"
@@ -31,58 +36,100 @@ namespace Toy{
 
 
 %union {
-    int numVal;
+    double numVal;
+    int64_t intVal;
+    Toy::Type typeVal;
     std::string* strVal;
     Toy::ExprAST* exprVal;
     Toy::PrototypeAST* protoVal;
     Toy::FunctionAST* funcVal;
     Toy::IfElseExprAST* ifVal;
-    std::vector<std::string>* parmList;
+    std::vector<Toy::Parameter>* parmList;
     std::vector<std::unique_ptr<Toy::ExprAST>>* argList;
+    std::vector<std::string>* attrList;
+    llvm::Value* irVal;
+    llvm::Function* funcIR;
+    llvm::BranchInst* branchIR;
+    std::vector<llvm::Value*>* irList;
 }
 
 
-%left ADD SUB            // 优先级最低（加减）
+%precedence SEMI         // 仅用于流式模式拒绝语句块
+%right ASSIGN            // 赋值，优先级最低
+%left ADD SUB            // 优先级较低（加减）
 %left MUL DIV            // 优先级中等（乘除）
 %left LT LE GT GE EQ NE  // 优先级最高（比较）
 
 %token <numVal> NUMBER
+%token <intVal> INTEGER
 %token <strVal> IDENTIFIER
-%token DEF EXTERN IF ELSE
+%token <typeVal> TYPE
+%token <strVal> ATTRIBUTE
+%token DEF EXTERN IF ELSE VAR WHILE FOR PAR
 %token LT GT EQ LE GE NE ASSIGN
 %token ADD SUB MUL DIV
-%token LPAREN RPAREN LBRACE RBRACE COMMA SEMI
+%token LPAREN RPAREN LBRACE RBRACE LBRACKET RBRACKET COMMA SEMI COLON
+%token START_PROGRAM START_STREAM  // 由 Scanner 首先返回，选择解析模式
 
-%type <exprVal> expr
+%type <exprVal> expr block
+%type <argList> stmts
 %type <protoVal> proto
 %type <funcVal> function
 %type <parmList> parms
+%type <typeVal> typeopt
+%type <attrList> attrs
 %type <argList> args
+%type <irVal> value
+%type <irList> values
 
 
 %%
 
+unit:
+    START_PROGRAM program
+    | START_STREAM stream
+    ;
+
 program:
-    | program function {
-        $2->codegen();
-        LOG_DEBUG() << $2->to_string() << '\n';
+    | program attrs function {
+        std::unique_ptr<std::vector<std::string>> attrs($2);
+        auto func = $3;
+        func->getProto().setAttributes(std::move(*attrs));
+        module.addFunction(func);
     }
-    | program EXTERN proto {
-        $3->codegen();
-        LOG_DEBUG() << $3->to_string() << '\n';
+    | program attrs EXTERN proto {
+        std::unique_ptr<std::vector<std::string>> attrs($2);
+        auto proto = $4;
+        proto->setAttributes(std::move(*attrs));
+        module.addExtern(proto);
+    }
+    ;
+
+/* 函数与 extern 前的 @属性 */
+attrs:
+    /* empty */ { $$ = new std::vector<std::string>(); }
+    | attrs ATTRIBUTE {
+        std::unique_ptr<std::string> name($2);
+        if (!Toy::PrototypeAST::isAttribute(*name)) {
+            error(@2, "unknown attribute @" + *name);
+            YYERROR;
+        }
+        $$->push_back(*name);
     }
     ;
 
 function:
-    DEF IDENTIFIER LPAREN parms RPAREN LBRACE expr RBRACE {
-        auto proto = new Toy::PrototypeAST(*$2, *$4);
-        $$ = new Toy::FunctionAST(proto, $7);
+    DEF IDENTIFIER LPAREN parms RPAREN typeopt LBRACE block RBRACE {
+        auto proto = new Toy::PrototypeAST(*$2, *$4, $6);
+        // 行号供 -g 调试信息使用
+        proto->setLine(@1.begin.line);
+        $$ = new Toy::FunctionAST(proto, $8);
     }
     ;
 
 proto:
-    IDENTIFIER LPAREN parms RPAREN {
-        $$ = new Toy::PrototypeAST(*$1, *$3);
+    IDENTIFIER LPAREN parms RPAREN typeopt {
+        $$ = new Toy::PrototypeAST(*$1, *$3, $5);
     }
     | IDENTIFIER {
         $$ = new Toy::PrototypeAST(*$1, {});
@@ -90,13 +137,28 @@ proto:
     ;
 
 parms:
-    /* empty */ { $$ = new std::vector<std::string>(); }
-    | IDENTIFIER {
-        $$ = new std::vector<std::string>();
-        $$->push_back(*$1);
+    /* empty */ { $$ = new std::vector<Toy::Parameter>(); }
+    | IDENTIFIER typeopt {
+        auto type = $2;
+        $$ = new std::vector<Toy::Parameter>();
+        $$->push_back({*$1, type, type != Toy::Type::Unknown});
     }
-    | parms COMMA IDENTIFIER {
-        $1->push_back(*$3);
+    | parms COMMA IDENTIFIER typeopt {
+        auto type = $4;
+        $1->push_back({*$3, type, type != Toy::Type::Unknown});
+    }
+    ;
+
+/* 可选的类型标注，缺省时由类型推导决定 */
+typeopt:
+    /* empty */ { $$ = Toy::Type::Unknown; }
+    | COLON TYPE { $$ = $2; }
+    | COLON TYPE LBRACKET RBRACKET {
+        if ($2 != Toy::Type::Double) {
+            error(@2, "only double arrays are supported");
+            YYERROR;
+        }
+        $$ = Toy::Type::Array;
     }
     ;
 
@@ -109,10 +171,32 @@ args:
      | args COMMA expr {
         $1->emplace_back($3);
      }
+     ;
+
+/* 以分号分隔的表达式序列，值为最后一个表达式 */
+block:
+    stmts { $$ = new Toy::BlockExprAST(*$1); }
+    | stmts SEMI { $$ = new Toy::BlockExprAST(*$1); }
+    ;
+
+stmts:
+    expr {
+        auto stmt = $1;
+        stmt->setLine(@1.begin.line);
+        $$ = new std::vector<std::unique_ptr<Toy::ExprAST>>();
+        $$->emplace_back(stmt);
+    }
+    | stmts SEMI expr {
+        auto stmt = $3;
+        stmt->setLine(@3.begin.line);
+        $1->emplace_back(stmt);
+    }
+    ;
 
 
 expr:
     NUMBER         { $$ = new Toy::NumberExprAST($1); }
+    | INTEGER        { $$ = new Toy::IntegerExprAST($1); }
     | IDENTIFIER     { $$ = new Toy::VariableExprAST(*$1); }
     | expr ADD expr  { $$ = new Toy::BinaryExprAST(Toy::BinaryExprAST::OpType::ADD, $1, $3); }
     | expr SUB expr  { $$ = new Toy::BinaryExprAST(Toy::BinaryExprAST::OpType::SUB, $1, $3); }
@@ -126,13 +210,169 @@ expr:
     | expr NE expr   { $$ = new Toy::BinaryExprAST(Toy::BinaryExprAST::OpType::NE, $1, $3); }
     | IDENTIFIER LPAREN args RPAREN {
         $$ = new Toy::CallExprAST(*$1, *$3);
+        $$->setLine(@1.begin.line);
     }
-    | IF expr LBRACE expr RBRACE ELSE LBRACE expr RBRACE {
+    | IF expr LBRACE block RBRACE ELSE LBRACE block RBRACE {
         $$ = new Toy::IfElseExprAST($2, $4, $8);
     }
+    | VAR IDENTIFIER typeopt ASSIGN expr {
+        auto type = $3;
+        $$ = new Toy::VarExprAST({*$2, type, type != Toy::Type::Unknown}, $5);
+    }
+    | IDENTIFIER ASSIGN expr {
+        $$ = new Toy::AssignExprAST(*$1, $3);
+    }
+    | IDENTIFIER LBRACKET expr RBRACKET {
+        $$ = new Toy::IndexExprAST(*$1, $3);
+    }
+    | IDENTIFIER LBRACKET expr RBRACKET ASSIGN expr {
+        $$ = new Toy::IndexExprAST(*$1, $3, $6);
+    }
+    | WHILE expr LBRACE block RBRACE {
+        $$ = new Toy::WhileExprAST($2, $4);
+    }
+    | FOR IDENTIFIER ASSIGN expr COMMA expr LBRACE block RBRACE {
+        $$ = new Toy::ForExprAST(*$2, $4, $6, nullptr, $8);
+    }
+    | FOR IDENTIFIER ASSIGN expr COMMA expr COMMA expr LBRACE block RBRACE {
+        $$ = new Toy::ForExprAST(*$2, $4, $6, $8, $10);
+    }
+    | PAR LPAREN expr RPAREN {
+        std::unique_ptr<Toy::ExprAST> expr($3);
+        // 并行求值二元运算的两个操作数，或调用的各个参数
+        if (!dynamic_cast<Toy::BinaryExprAST *>(expr.get()) &&
+            !dynamic_cast<Toy::CallExprAST *>(expr.get())) {
+            error(@3, "par expects a binary operation or a call");
+            YYERROR;
+        }
+        $$ = new Toy::ParExprAST(expr.release());
+    }
     | LPAREN expr RPAREN { $$ = $2; }
     ;
 
+/* 流式模式：归约时直接通过 IRBuilder 生成 IR，不构建 AST */
+stream:
+    | stream sfunction
+    | stream attrs EXTERN proto {
+        std::unique_ptr<std::vector<std::string>> attrs($2);
+        std::unique_ptr<Toy::PrototypeAST> proto($4);
+        proto->setAttributes(std::move(*attrs));
+        // 数学内建函数直接降为 intrinsic，无需声明
+        if (!proto->isMathBuiltin()) {
+            proto->codegen();
+        }
+    }
+    ;
+
+sfunction:
+    DEF IDENTIFIER LPAREN parms RPAREN typeopt {
+        std::unique_ptr<std::string> name($2);
+        std::unique_ptr<std::vector<Toy::Parameter>> parms($4);
+        auto ret = $6;
+        for (auto &i : *parms) {
+            if (i.type == Toy::Type::Array) {
+                error(@4, "arrays need the AST, compile without --stream");
+                YYABORT;
+            }
+        }
+        if (ret == Toy::Type::Array) {
+            error(@6, "arrays need the AST, compile without --stream");
+            YYABORT;
+        }
+        Toy::PrototypeAST proto(*name, std::move(*parms), ret);
+        if (!($<funcIR>$ = Toy::FunctionAST::begin(proto))) {
+            YYABORT;
+        }
+    } LBRACE value RBRACE {
+        if (!Toy::FunctionAST::finish($<funcIR>7, $9)) {
+            YYABORT;
+        }
+    }
+    ;
+
+values:
+     /* empty */ { $$ = new std::vector<llvm::Value*>(); }
+     | value {
+        $$ = new std::vector<llvm::Value*>();
+        $$->push_back($1);
+     }
+     | values COMMA value {
+        $1->push_back($3);
+     }
+     ;
+
+value:
+    NUMBER         { $$ = Toy::NumberExprAST::emit($1); }
+    | INTEGER        { $$ = Toy::IntegerExprAST::emit($1); }
+    | IDENTIFIER     {
+        std::unique_ptr<std::string> name($1);
+        if (!($$ = Toy::VariableExprAST::emit(*name))) {
+            YYABORT;
+        }
+    }
+    | value ADD value  { if (!($$ = Toy::BinaryExprAST::emit(Toy::BinaryExprAST::OpType::ADD, $1, $3))) YYABORT; }
+    | value SUB value  { if (!($$ = Toy::BinaryExprAST::emit(Toy::BinaryExprAST::OpType::SUB, $1, $3))) YYABORT; }
+    | value MUL value  { if (!($$ = Toy::BinaryExprAST::emit(Toy::BinaryExprAST::OpType::MUL, $1, $3))) YYABORT; }
+    | value DIV value  { if (!($$ = Toy::BinaryExprAST::emit(Toy::BinaryExprAST::OpType::DIV, $1, $3))) YYABORT; }
+    | value LT value   { if (!($$ = Toy::BinaryExprAST::emit(Toy::BinaryExprAST::OpType::LT, $1, $3))) YYABORT; }
+    | value LE value   { if (!($$ = Toy::BinaryExprAST::emit(Toy::BinaryExprAST::OpType::LE, $1, $3))) YYABORT; }
+    | value GT value   { if (!($$ = Toy::BinaryExprAST::emit(Toy::BinaryExprAST::OpType::GT, $1, $3))) YYABORT; }
+    | value GE value   { if (!($$ = Toy::BinaryExprAST::emit(Toy::BinaryExprAST::OpType::GE, $1, $3))) YYABORT; }
+    | value EQ value   { if (!($$ = Toy::BinaryExprAST::emit(Toy::BinaryExprAST::OpType::EQ, $1, $3))) YYABORT; }
+    | value NE value   { if (!($$ = Toy::BinaryExprAST::emit(Toy::BinaryExprAST::OpType::NE, $1, $3))) YYABORT; }
+    | IDENTIFIER LPAREN values RPAREN {
+        std::unique_ptr<std::string> callee($1);
+        std::unique_ptr<std::vector<llvm::Value*>> args($3);
+        if (!($$ = Toy::CallExprAST::emit(*callee, *args))) {
+            YYABORT;
+        }
+    }
+    | IF value {
+        if (!($<branchIR>$ = Toy::IfElseExprAST::emitCond($2))) {
+            YYABORT;
+        }
+    } LBRACE value RBRACE {
+        $<branchIR>$ = Toy::IfElseExprAST::emitElse($<branchIR>3);
+    } ELSE LBRACE value RBRACE {
+        if (!($$ = Toy::IfElseExprAST::emitMerge($<branchIR>7, $5, $10))) {
+            YYABORT;
+        }
+    }
+    | LPAREN value RPAREN { $$ = $2; }
+    /* 以下特性只在 AST 路径上实现，流式模式给出明确的错误 */
+    | value SEMI {
+        $$ = nullptr;
+        error(@2, "blocks need the AST, compile without --stream");
+        YYABORT;
+    }
+    | VAR {
+        $$ = nullptr;
+        error(@1, "var needs the AST, compile without --stream");
+        YYABORT;
+    }
+    | WHILE {
+        $$ = nullptr;
+        error(@1, "loops need the AST, compile without --stream");
+        YYABORT;
+    }
+    | FOR {
+        $$ = nullptr;
+        error(@1, "loops need the AST, compile without --stream");
+        YYABORT;
+    }
+    | PAR {
+        $$ = nullptr;
+        error(@1, "par needs the AST, compile without --stream");
+        YYABORT;
+    }
+    | IDENTIFIER LBRACKET {
+        std::unique_ptr<std::string> name($1);
+        $$ = nullptr;
+        error(@2, "arrays need the AST, compile without --stream");
+        YYABORT;
+    }
+    ;
+
 %%
 
 void Toy::Parser::error(const location_type& loc, const std::string& msg) {